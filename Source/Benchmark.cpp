@@ -0,0 +1,331 @@
+/*
+  ==============================================================================
+
+    Benchmark.cpp
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+// Timings of the hot paths. Defining MIDI2LR_BENCHMARK in a Release
+// configuration's preprocessor definitions builds this application instead of
+// MIDI2LR: it runs each benchmark once, writes the results to benchmark.txt
+// next to the executable and quits. Quit Lightroom first, the benchmarks play
+// the plugin on its ports.
+#ifdef MIDI2LR_BENCHMARK
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "CommandMap.h"
+#include "ControllerDecoder.h"
+#include "LatencyStats.h"
+#include "LR_IPC_In.h"
+#include "LR_IPC_Out.h"
+#include "LRCommands.h"
+#include "MIDIProcessor.h"
+
+namespace {
+  constexpr auto kLrOutPort = 58763;
+  constexpr auto kLrInPort = 58764;
+  constexpr auto kLookupPasses = 1000; // over every CC/note x channel x number
+  constexpr auto kRoundTrips = 10000;
+  constexpr auto kStreamLines = 200000;
+  constexpr auto kMaxLineLength = 1024; // LR_IPC_IN drops longer lines
+  constexpr auto kTimeout = 5000; // milliseconds, to connect or to parse the stream
+
+  // the message:command map CommandMap replaced and its hash, for comparison
+  struct XorHash {
+    std::size_t operator()(const MIDI_Message& k) const noexcept {
+      return (std::hash<bool>()(k.isCC) ^ std::hash<int>()(k.channel) ^
+        (std::hash<int>()(k.data) << 1));
+    }
+  };
+
+  double ElapsedMilliseconds(int64 start_ticks) noexcept {
+    return Time::highResolutionTicksToSeconds(
+      Time::getHighResolutionTicks() - start_ticks) * 1000.0;
+  }
+
+  // median, 99th percentile and maximum of samples in milliseconds, as
+  // microseconds
+  String Percentiles(std::vector<double>& samples) {
+    if (samples.empty())
+      return "no samples";
+    std::sort(samples.begin(), samples.end());
+    const auto at = [&samples](double fraction) {
+      return samples[static_cast<size_t>(fraction * (samples.size() - 1))] * 1000.0;
+    };
+    return "median " + String(at(0.5), 1) + " us, 99% " + String(at(0.99), 1) +
+      " us, max " + String(samples.back() * 1000.0, 1) + " us";
+  }
+
+  // whether what LR_IPC_OUT wrote starts with a request to ack the value after
+  // it, see SendRateControl
+  bool IsAckRequest(const std::string& received) {
+    return received.compare(0, 8, "AckNext ") == 0;
+  }
+
+  // every CC and note on every channel mapped, looked up through
+  // getMappingForMessage, also for a device without mappings of its own and
+  // one with, and through the old unordered_map<MIDI_Message, String>
+  String BenchmarkLookup() {
+    CommandMap command_map;
+    std::unordered_map<MIDI_Message, String, XorHash> old_map;
+    std::vector<MIDI_Message> messages;
+    const auto command_count = LRCommandList::getCommandCount();
+    command_map.beginUpdate();
+    for (auto is_cc = 0; is_cc < 2; ++is_cc) {
+      for (auto channel = 1; channel <= 16; ++channel) {
+        for (auto number = 0; number < 128; ++number) {
+          messages.emplace_back(channel, number, is_cc == 1);
+          const auto command = static_cast<LRCommandId>(
+            1 + messages.size() % (command_count - 1));
+          command_map.addCommandforMessage(command, messages.back());
+          old_map[messages.back()] = LRCommandList::getCommandString(command);
+        }
+      }
+    }
+    command_map.endUpdate();
+
+    size_t checksum = 0; // keeps the lookups from being optimized away
+    auto start = Time::getHighResolutionTicks();
+    for (auto pass = 0; pass < kLookupPasses; ++pass) {
+      for (const auto& message : messages)
+        checksum += command_map.getMappingForMessage(message).command;
+    }
+    const auto flat = ElapsedMilliseconds(start);
+
+    auto device_messages = messages;
+    for (auto& message : device_messages)
+      message.device = 1;
+    start = Time::getHighResolutionTicks();
+    for (auto pass = 0; pass < kLookupPasses; ++pass) {
+      for (const auto& message : device_messages)
+        checksum += command_map.getMappingForMessage(message).command;
+    }
+    const auto fallback = ElapsedMilliseconds(start);
+
+    command_map.beginUpdate(); // as if every control was learned on the device
+    for (size_t idx = 0; idx < device_messages.size(); ++idx)
+      command_map.addCommandforMessage(static_cast<LRCommandId>(
+        1 + (idx + 1) % (command_count - 1)), device_messages[idx]);
+    command_map.endUpdate();
+    start = Time::getHighResolutionTicks();
+    for (auto pass = 0; pass < kLookupPasses; ++pass) {
+      for (const auto& message : device_messages)
+        checksum += command_map.getMappingForMessage(message).command;
+    }
+    const auto learned = ElapsedMilliseconds(start);
+
+    start = Time::getHighResolutionTicks();
+    for (auto pass = 0; pass < kLookupPasses; ++pass) {
+      for (const auto& message : messages) {
+        const auto found = old_map.find(message);
+        if (found != old_map.end())
+          checksum += static_cast<size_t>(found->second.length());
+      }
+    }
+    const auto hashed = ElapsedMilliseconds(start);
+
+    const auto lookups = static_cast<double>(kLookupPasses) * messages.size();
+    return "getMappingForMessage: " + String(flat * 1e6 / lookups, 1) +
+      " ns per lookup\n"
+      "getMappingForMessage, device without mappings: " +
+      String(fallback * 1e6 / lookups, 1) + " ns per lookup\n"
+      "getMappingForMessage, device with its own mappings: " +
+      String(learned * 1e6 / lookups, 1) + " ns per lookup\n"
+      "unordered_map<MIDI_Message, String>: " + String(hashed * 1e6 / lookups, 1) +
+      " ns per lookup (checksum " + String(static_cast<int64>(checksum)) + ")\n";
+  }
+
+  // a CC through the decoder, the lookup and LR_IPC_OUT until its line is read
+  // from a socket standing in for the plugin, which acknowledges it at once if
+  // asked to.
+  // One value at a time, so this is the latency of an idle connection
+  String BenchmarkCCToSocket() {
+    StreamingSocket listener;
+    if (!listener.createListener(kLrOutPort, "127.0.0.1"))
+      return "CC to socket: port " + String(kLrOutPort) + " is in use\n";
+    auto command_map = std::make_shared<CommandMap>();
+    std::shared_ptr<MIDIProcessor> no_processor;
+    const MIDI_Message mapped{1, 7, true};
+    const auto command = LRCommandList::getCommandId("Exposure");
+    command_map->addCommandforMessage(command, mapped);
+    command_map->setTakeoverModeForMessage(mapped, TAKEOVER_MODE::JUMP);
+    LR_IPC_OUT lr_ipc_out;
+    lr_ipc_out.setCoalesceWindow(0);
+    lr_ipc_out.Init(command_map, no_processor);
+    std::unique_ptr<StreamingSocket> plugin{listener.waitForNextConnection()};
+    const auto connect_start = Time::getMillisecondCounter();
+    while (lr_ipc_out.getConnectionState() == CONNECTION_STATE::DISCONNECTED &&
+      Time::getMillisecondCounter() - connect_start < kTimeout)
+      Thread::sleep(1);
+    if (!plugin || lr_ipc_out.getConnectionState() == CONNECTION_STATE::DISCONNECTED)
+      return "CC to socket: LR_IPC_OUT didn't connect\n";
+    char buffer[4096];
+    if (plugin->waitUntilReady(true, 200) == 1) // e.g. a subscription
+      plugin->read(buffer, sizeof(buffer), false);
+
+    ControllerDecoder decoder;
+    std::vector<ControllerDecoder::Event> decoded;
+    std::vector<double> samples;
+    samples.reserve(kRoundTrips);
+    std::string received;
+    for (auto trip = 0; trip < kRoundTrips; ++trip) {
+      const auto start = LatencyStats::now();
+      decoder.process(mapped.channel, mapped.controller, trip % 128, false, start,
+        decoded);
+      for (const auto& event : decoded) {
+        lr_ipc_out.handleMidiCC(command_map->getMappingForMessage(event.message),
+          event.message, event.value, event.max_value, start);
+      }
+      decoded.clear();
+      received.clear();
+      auto line_read = false;
+      while (!line_read && plugin->waitUntilReady(true, 1000) == 1) {
+        const auto size = plugin->read(buffer, sizeof(buffer), false);
+        if (size <= 0)
+          break;
+        received.append(buffer, static_cast<size_t>(size));
+          // an ack request comes before the value it is for
+        line_read = std::count(received.begin(), received.end(), '\n') >
+          (IsAckRequest(received) ? 1 : 0);
+      }
+      if (!line_read)
+        return "CC to socket: no line after " + String(trip) + " values\n";
+      const auto end = LatencyStats::now();
+      samples.push_back(end - start);
+      if (IsAckRequest(received))
+        lr_ipc_out.acknowledged(command, end);
+    }
+    lr_ipc_out.PleaseStopThread();
+    return "CC to socket: " + Percentiles(samples) + "\n";
+  }
+
+  // a stream of develop parameter values as the plugin sends them, every
+  // parameter mapped. The names are looked up the way LR_IPC_IN does and the
+  // way it did with String and unordered_map<String, int>, then the stream is
+  // fed to LR_IPC_IN through a socket. An oversize line ends it: LR_IPC_IN
+  // counts it once every line before it has been parsed
+  String BenchmarkLineParse() {
+    const auto& parameters = LRCommandList::DevelopParameters;
+    auto command_map = std::make_shared<CommandMap>();
+    std::unordered_map<String, int> old_map;
+    command_map->beginUpdate();
+    for (size_t idx = 0; idx < parameters.size(); ++idx) {
+      const auto number = static_cast<int>(idx);
+      command_map->addCommandforMessage(parameters[idx],
+        MIDI_Message{1 + number / 128, number % 128, true});
+      old_map[parameters[idx]] = number;
+    }
+    command_map->endUpdate();
+    std::string stream;
+    for (auto line = 0; line < kStreamLines; ++line) {
+      stream += parameters[static_cast<size_t>(line) % parameters.size()].toRawUTF8();
+      stream += ' ';
+      stream += String(line % 12701 / 100.0).toRawUTF8(); // as Lua's %g
+      stream += '\n';
+    }
+
+    size_t checksum = 0;
+    auto start = Time::getHighResolutionTicks();
+    for (auto line = stream.data(), end = line + stream.size(); line < end;) {
+      const auto space = static_cast<const char*>(std::memchr(line, ' ',
+        static_cast<size_t>(end - line)));
+      checksum += LRCommandList::findCommandId(line,
+        static_cast<size_t>(space - line));
+      line = static_cast<const char*>(std::memchr(space, '\n',
+        static_cast<size_t>(end - space))) + 1;
+    }
+    const auto in_place = ElapsedMilliseconds(start);
+    start = Time::getHighResolutionTicks();
+    for (auto line = stream.data(), end = line + stream.size(); line < end;) {
+      const auto newline = static_cast<const char*>(std::memchr(line, '\n',
+        static_cast<size_t>(end - line)));
+      const auto text = String::fromUTF8(line, static_cast<int>(newline - line)).trim();
+      const auto found = old_map.find(text.upToFirstOccurrenceOf(" ", false, false));
+      if (found != old_map.end())
+        checksum += static_cast<size_t>(found->second +
+          text.fromFirstOccurrenceOf(" ", false, false).getIntValue());
+      line = newline + 1;
+    }
+    const auto with_strings = ElapsedMilliseconds(start);
+    auto report = "parameter name lookup: " +
+      String(in_place * 1e6 / kStreamLines, 1) + " ns per line, with String and "
+      "unordered_map: " + String(with_strings * 1e6 / kStreamLines, 1) +
+      " ns per line (checksum " + String(static_cast<int64>(checksum)) + ")\n";
+
+    StreamingSocket listener;
+    if (!listener.createListener(kLrInPort, "127.0.0.1"))
+      return report + "line parse: port " + String(kLrInPort) + " is in use\n";
+    std::shared_ptr<ProfileManager> no_profile_manager;
+    std::shared_ptr<MIDISender> no_midi_sender;
+    std::shared_ptr<LR_IPC_OUT> no_lr_ipc_out;
+    LR_IPC_IN lr_ipc_in;
+    lr_ipc_in.Init(command_map, no_profile_manager, no_midi_sender, no_lr_ipc_out);
+    std::unique_ptr<StreamingSocket> plugin{listener.waitForNextConnection()};
+    if (!plugin)
+      return report + "line parse: LR_IPC_IN didn't connect\n";
+    stream.append(kMaxLineLength + 1, 'x');
+    stream += '\n';
+    start = Time::getHighResolutionTicks();
+    if (plugin->write(stream.data(), static_cast<int>(stream.size())) < 0)
+      return report + "line parse: the stream couldn't be written\n";
+    while (lr_ipc_in.getOversizeLineCount() == 0 &&
+      ElapsedMilliseconds(start) < kTimeout)
+      Thread::yield();
+    const auto streamed = ElapsedMilliseconds(start);
+    lr_ipc_in.PleaseStopThread();
+    if (lr_ipc_in.getOversizeLineCount() == 0)
+      return report + "line parse: LR_IPC_IN didn't finish the stream\n";
+    return report + "line parse through LR_IPC_IN: " +
+      String(kStreamLines / streamed / 1000.0, 2) + " million lines per second\n";
+  }
+}
+
+class BenchmarkApplication: public JUCEApplication {
+public:
+  const String getApplicationName() override {
+    return "MIDI2LR benchmark";
+  }
+  const String getApplicationVersion() override {
+    return ProjectInfo::versionString;
+  }
+  bool moreThanOneInstanceAllowed() override {
+    return false;
+  }
+
+  void initialise(const String& /*command_line*/) override {
+    LatencyStats::reset();
+    auto report = BenchmarkLookup();
+    report += BenchmarkCCToSocket();
+    report += BenchmarkLineParse();
+    report += "\n" + LatencyStats::getReport();
+    Logger::outputDebugString(report);
+    File::getSpecialLocation(File::currentExecutableFile)
+      .getSiblingFile("benchmark.txt").replaceWithText(report);
+    quit();
+  }
+
+  void shutdown() override {}
+};
+
+START_JUCE_APPLICATION(BenchmarkApplication)
+
+#endif  // MIDI2LR_BENCHMARK
@@ -0,0 +1,123 @@
+/*
+  ==============================================================================
+
+    CCCoalescer.cpp
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#include "CCCoalescer.h"
+#include <cstdio>
+#include "LatencyStats.h"
+
+CCCoalescer::CCCoalescer(): slots_(LRCommandList::kMaxCommands) {
+  order_.reserve(LRCommandList::kMaxCommands);
+  last_drain_.reserve(LRCommandList::kMaxCommands);
+}
+
+void CCCoalescer::add(LRCommandId command, double value, double timestamp) {
+  if (command >= slots_.size())
+    return;
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  auto& slot = Touch_(command, timestamp);
+  slot.value = value;
+  slot.relative = false;
+}
+
+void CCCoalescer::addDelta(LRCommandId command, double delta, double timestamp) {
+  if (command >= slots_.size())
+    return;
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  auto& slot = Touch_(command, timestamp);
+  if (!slot.relative) { // replaces an absolute value not yet sent
+    slot.value = 0.0;
+    slot.relative = true;
+  }
+  slot.value += delta;
+}
+
+bool CCCoalescer::empty() const {
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  return order_.empty();
+}
+
+void CCCoalescer::drainTo(std::string& out, std::vector<double>& timestamps,
+  std::vector<LRCommandId>& commands) {
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  last_drain_.clear();
+  for (auto command : order_) {
+    auto& slot = slots_[command];
+    const auto value = slot.value;
+    const auto relative = slot.relative;
+    slot.pending = false;
+    slot.value = 0.0; // steps after this drain are summed from zero
+    slot.relative = false;
+    LatencyStats::recordSince(LATENCY_STAGE::COALESCE, slot.queued);
+    if (relative && value == 0.0)
+      continue; // steps that cancelled out need no line
+    appendLine(out, command, value, relative);
+    timestamps.push_back(slot.timestamp);
+    commands.push_back(command);
+    last_drain_.push_back({command, value, relative});
+  }
+  order_.clear();
+}
+
+void CCCoalescer::restoreDrained() {
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  for (const auto& drained : last_drain_) {
+    auto& slot = slots_[drained.command];
+    if (!slot.pending) {
+      Touch_(drained.command, 0.0).queued = 0.0;
+      slot.value = drained.value;
+      slot.relative = drained.relative;
+    }
+    else if (slot.relative && drained.relative)
+      slot.value += drained.value;
+  }
+  last_drain_.clear();
+}
+
+void CCCoalescer::clear() {
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  for (auto command : order_) {
+    auto& slot = slots_[command];
+    slot.pending = false;
+    slot.value = 0.0;
+    slot.relative = false;
+  }
+  order_.clear();
+  last_drain_.clear();
+}
+
+CCCoalescer::Slot& CCCoalescer::Touch_(LRCommandId command, double timestamp) {
+  auto& slot = slots_[command];
+  if (!slot.pending) {
+    slot.pending = true;
+    slot.timestamp = timestamp;
+    slot.queued = LatencyStats::now();
+    order_.push_back(command);
+  }
+  return slot;
+}
+
+void CCCoalescer::appendLine(std::string& out, LRCommandId command, double value,
+  bool relative) {
+    // %g prints whole values exactly as the 7-bit integers they were
+  char text[32];
+  std::snprintf(text, sizeof text, relative ? " %+g\n" : " %g\n", value);
+  out += LRCommandList::getCommandString(command).toRawUTF8();
+  out += text;
+}
@@ -0,0 +1,94 @@
+#pragma once
+/*
+  ==============================================================================
+
+    CCCoalescer.h
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#ifndef CCCOALESCER_H_INCLUDED
+#define CCCOALESCER_H_INCLUDED
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "LRCommands.h"
+
+// Holds the newest value of each continuous command until it is sent, so a
+// fast fader sweep produces at most one line per command per flush.
+class CCCoalescer {
+public:
+  CCCoalescer();
+
+  // stores the value for a command, replacing any value not yet sent. Values
+  // are in the plugin's 0-127 range, fractions come from 14-bit controllers.
+  // timestamp is when the MIDI message arrived, see LatencyStats
+  void add(LRCommandId command, double value, double timestamp = 0.0);
+
+  // adds a step from a relative controller to the command's waiting change.
+  // Steps are summed, and sent as a signed change instead of a value
+  void addDelta(LRCommandId command, double delta, double timestamp = 0.0);
+
+  // returns true if no value is waiting to be sent
+  bool empty() const;
+
+  // appends a "command value\n" line for each waiting command, "command +n\n"
+  // or "command -n\n" for summed steps, in the order the commands were first
+  // touched, and empties the coalescer. The arrival time of the oldest input
+  // merged into each line is appended to timestamps, and its command to
+  // commands. Doesn't allocate once they have the capacity
+  void drainTo(std::string& out, std::vector<double>& timestamps,
+    std::vector<LRCommandId>& commands);
+
+  // puts the values of the last drainTo back, e.g. because they couldn't be
+  // written. A value stored since replaces the drained one, steps stored since
+  // are added to drained steps. Restored values aren't traced
+  void restoreDrained();
+
+  // discards all waiting values
+  void clear();
+
+  // appends the line drainTo would write for a value, or for a summed change
+  // if relative
+  static void appendLine(std::string& out, LRCommandId command, double value,
+    bool relative);
+
+private:
+  struct Slot {
+    double value{0.0};
+    bool pending{false};
+    bool relative{false}; // value is a summed change
+    double timestamp{0.0}; // arrival of the oldest input merged in
+    double queued{0.0}; // when the slot started waiting
+  };
+
+  struct Drained {
+    LRCommandId command;
+    double value;
+    bool relative;
+  };
+
+  // marks the slot waiting, called with mutex_ held
+  Slot& Touch_(LRCommandId command, double timestamp);
+
+  mutable std::mutex mutex_;
+  std::vector<Slot> slots_; // indexed by command id
+  std::vector<LRCommandId> order_;
+  std::vector<Drained> last_drain_; // lines written by the last drainTo
+};
+
+#endif  // CCCOALESCER_H_INCLUDED
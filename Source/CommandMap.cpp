@@ -21,70 +21,491 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "CommandMap.h"
 #include "LRCommands.h"
+#include "MIDIDeviceList.h"
 
-CommandMap::CommandMap() noexcept : Subject{} {}
+const CommandMapping CommandMap::kNoMapping{LRCommandList::kNoCommand,
+  ACTION_KIND::LEARN_ONLY, CC_MODE::ABS, CC_RESOLUTION::CC7,
+  FEEDBACK_FORMAT::CC7, TAKEOVER_MODE::DEFAULT};
 
-void CommandMap::addCommandforMessage(unsigned int command, const MIDI_Message &message) {
+namespace {
+  ACTION_KIND ActionKindForCommand(LRCommandId command) noexcept {
+    if (command == LRCommandList::kUnmapped)
+      return ACTION_KIND::UNMAPPED;
+    if (command == LRCommandList::kPreviousProfile)
+      return ACTION_KIND::PREVIOUS_PROFILE;
+    if (command == LRCommandList::kNextProfile)
+      return ACTION_KIND::NEXT_PROFILE;
+    return ACTION_KIND::SEND_TO_LR;
+  }
+}
+
+String CCModeName(CC_MODE mode) {
+  switch (mode) {
+    case CC_MODE::TWOS_COMPLEMENT:
+      return "TwosComplement";
+    case CC_MODE::SIGN_MAGNITUDE:
+      return "SignMagnitude";
+    case CC_MODE::BINARY_OFFSET:
+      return "BinaryOffset";
+    default:
+      return "Absolute";
+  }
+}
+
+CC_MODE CCModeFromName(const String& name) {
+  if (name == "SignMagnitude")
+    return CC_MODE::SIGN_MAGNITUDE;
+  if (name == "BinaryOffset")
+    return CC_MODE::BINARY_OFFSET;
+  if (name == "Absolute")
+    return CC_MODE::ABS;
+  return CC_MODE::TWOS_COMPLEMENT; // the most common relative encoding
+}
+
+String CCResolutionName(CC_RESOLUTION resolution) {
+  return resolution == CC_RESOLUTION::CC14 ? "CC14" : "CC7";
+}
+
+CC_RESOLUTION CCResolutionFromName(const String& name) {
+  return name == "CC14" ? CC_RESOLUTION::CC14 : CC_RESOLUTION::CC7;
+}
+
+String FeedbackFormatName(FEEDBACK_FORMAT format) {
+  switch (format) {
+    case FEEDBACK_FORMAT::CC14:
+      return "CC14";
+    case FEEDBACK_FORMAT::NRPN:
+      return "NRPN";
+    case FEEDBACK_FORMAT::PITCH_BEND:
+      return "PitchBend";
+    default:
+      return "CC7";
+  }
+}
+
+FEEDBACK_FORMAT FeedbackFormatFromName(const String& name) {
+  if (name == "CC14")
+    return FEEDBACK_FORMAT::CC14;
+  if (name == "NRPN")
+    return FEEDBACK_FORMAT::NRPN;
+  if (name == "PitchBend")
+    return FEEDBACK_FORMAT::PITCH_BEND;
+  return FEEDBACK_FORMAT::CC7;
+}
+
+FEEDBACK_FORMAT DefaultFeedbackFormat(const MIDI_Message& message) noexcept {
+  return message.isNRPN ? FEEDBACK_FORMAT::NRPN : FEEDBACK_FORMAT::CC7;
+}
+
+String TakeoverModeName(TAKEOVER_MODE mode) {
+  switch (mode) {
+    case TAKEOVER_MODE::PICKUP:
+      return "Pickup";
+    case TAKEOVER_MODE::SCALE:
+      return "Scale";
+    case TAKEOVER_MODE::JUMP:
+      return "Jump";
+    default:
+      return "Default";
+  }
+}
+
+TAKEOVER_MODE TakeoverModeFromName(const String& name) {
+  if (name == "Pickup")
+    return TAKEOVER_MODE::PICKUP;
+  if (name == "Scale")
+    return TAKEOVER_MODE::SCALE;
+  if (name == "Jump")
+    return TAKEOVER_MODE::JUMP;
+  return TAKEOVER_MODE::DEFAULT;
+}
+
+int RelativeDelta(CC_MODE mode, int value, int max_value) noexcept {
+  const auto sign_bit = (max_value + 1) / 2; // 64 or 8192
+  switch (mode) {
+    case CC_MODE::TWOS_COMPLEMENT:
+      return value < sign_bit ? value : value - (max_value + 1);
+    case CC_MODE::SIGN_MAGNITUDE:
+      return value < sign_bit ? value : sign_bit - value;
+    case CC_MODE::BINARY_OFFSET:
+      return value - sign_bit;
+    default:
+      return 0;
+  }
+}
+
+CommandMap::Table::Table(): command_messages(LRCommandList::kMaxCommands) {
+  message_tables[MIDIDeviceList::kAnyDevice] = std::make_shared<MessageTable>();
+  message_tables[MIDIDeviceList::kAnyDevice]->fill(kNoMapping);
+}
+
+CommandMap::ReadSnapshot::ReadSnapshot(const CommandMap& map) noexcept: map_(map) {
+    // count the reader before loading the pointer, see Commit_
+  ++map_.readers_;
+  table_ = map_.current_.load();
+}
+
+CommandMap::ReadSnapshot::~ReadSnapshot() {
+  --map_.readers_;
+}
+
+CommandMap::CommandMap() noexcept : Subject{}, current_{new Table} {}
+
+CommandMap::~CommandMap() {
+  delete current_.load();
+}
+
+int CommandMap::TableIndex_(const MIDI_Message& message) noexcept {
+  if (message.isNRPN || message.device < 0 || message.device >= kDeviceCount ||
+    message.channel < 1 || message.channel > 16 || message.data < 0 ||
+    message.data > 127)
+    return -1;
+  return ((message.isCC ? 16 : 0) + message.channel - 1) * 128 + message.data;
+}
+
+int CommandMap::SparseKey_(const MIDI_Message& message) noexcept {
+  if (!message.isNRPN || message.device < 0 || message.device >= kDeviceCount ||
+    message.channel < 1 || message.channel > 16 || message.data < 0 ||
+    message.data > 16383)
+    return -1;
+    // device:8 NRPN:1 CC:1 channel:4 data:14
+  return message.device << 20 | 1 << 19 | (message.isCC ? 1 << 18 : 0) |
+    (message.channel - 1) << 14 | message.data;
+}
+
+MIDI_Message CommandMap::MessageForSparseKey_(int key) noexcept {
+  MIDI_Message message{(key >> 14 & 0xF) + 1, key & 0x3FFF, (key >> 18 & 1) != 0};
+  message.isNRPN = (key >> 19 & 1) != 0;
+  message.device = key >> 20;
+  return message;
+}
+
+CommandMapping* CommandMap::FindSlot_(Table& table, const MIDI_Message& message) {
+  const auto index = TableIndex_(message);
+  if (index >= 0) {
+    auto& device_table = table.message_tables[message.device];
+    if (!device_table) {
+      device_table = std::make_shared<MessageTable>();
+      device_table->fill(kNoMapping);
+    }
+    else if (device_table.use_count() > 1) // a published version still reads it
+      device_table = std::make_shared<MessageTable>(*device_table);
+    return &(*device_table)[index];
+  }
+  const auto key = SparseKey_(message);
+  if (key < 0)
+    return nullptr;
+  return &table.sparse_table.emplace(key, kNoMapping).first->second;
+}
+
+const CommandMapping* CommandMap::FindSlot_(const Table& table,
+  const MIDI_Message& message) noexcept {
+  const auto index = TableIndex_(message);
+  if (index >= 0) {
+    const auto& device_table = table.message_tables[message.device];
+    return device_table ? &(*device_table)[index] : nullptr;
+  }
+  const auto found = table.sparse_table.find(SparseKey_(message));
+  return found != table.sparse_table.end() ? &found->second : nullptr;
+}
+
+CommandMap::Table& CommandMap::Draft_() {
+  if (!draft_)
+    draft_.reset(new Table(*current_.load()));
+  return *draft_;
+}
+
+bool CommandMap::Commit_() {
+  if (update_depth_ > 0 || !draft_)
+    return false;
+  retired_.emplace_back(current_.exchange(draft_.release()));
+    // a reader that arrives after the exchange can only see the new table, so
+    // if none is inside now, no one can still hold a retired one
+  if (readers_.load() == 0)
+    retired_.clear();
+  return true;
+}
+
+void CommandMap::beginUpdate() {
+  std::lock_guard<decltype(write_mutex_)> lock(write_mutex_);
+  ++update_depth_;
+}
+
+void CommandMap::endUpdate() {
+  {
+    std::lock_guard<decltype(write_mutex_)> lock(write_mutex_);
+    jassert(update_depth_ > 0);
+    if (update_depth_ > 0)
+      --update_depth_;
+    if (!Commit_())
+      return;
+  }
+  Notify();
+}
+
+void CommandMap::addCommandforMessage(LRCommandId command, const MIDI_Message &message) {
     // adds a message to the message:command map, and its associated command to the
     // command:message map
-  if (command < LRCommandList::LRStringList.size()) {
-    message_map_[message] = LRCommandList::LRStringList[command];
-    command_string_map_[LRCommandList::LRStringList[command]] = message;
+  if (command >= LRCommandList::getCommandCount())
+    return;
+
+  {
+    std::lock_guard<decltype(write_mutex_)> lock(write_mutex_);
+    auto& table = Draft_();
+    const auto slot = FindSlot_(table, message);
+    if (slot == nullptr)
+      return;
+    if (slot->command == LRCommandList::kNoCommand) {
+      table.mapped_count++;
+      slot->feedback = DefaultFeedbackFormat(message);
+    }
+    // a new command keeps the way the controller is read and shown
+    slot->command = command;
+    slot->kind = ActionKindForCommand(command);
+    if (command != LRCommandList::kPreviousProfile && command != LRCommandList::kNextProfile)
+      table.command_messages[command] = message;
+    if (!Commit_())
+      return;
   }
-  else
-    message_map_[message] = LRCommandList::NextPrevProfile[command - LRCommandList::LRStringList.size()];
+  Notify();
 }
 
 void CommandMap::addCommandforMessage(const String& command, const MIDI_Message &message) {
-  message_map_[message] = command;
-  command_string_map_[command] = message;
+  addCommandforMessage(LRCommandList::getCommandId(command), message);
+}
+
+LRCommandId CommandMap::getCommandIdForMessage(const MIDI_Message &message) const noexcept {
+  return getMappingForMessage(message).command;
+}
+
+CommandMapping CommandMap::getMappingForMessage(const MIDI_Message &message) const noexcept {
+  const ReadSnapshot table{*this};
+  const auto slot = FindSlot_(*table, message);
+  if (slot && slot->command != LRCommandList::kNoCommand)
+    return *slot;
+  if (message.device == MIDIDeviceList::kAnyDevice)
+    return kNoMapping;
+    // no mapping for this device, use the one for any device
+  auto any_device = message;
+  any_device.device = MIDIDeviceList::kAnyDevice;
+  const auto any_slot = FindSlot_(*table, any_device);
+  return any_slot ? *any_slot : kNoMapping;
 }
 
 const String& CommandMap::getCommandforMessage(const MIDI_Message &message) const {
-  return message_map_.at(message);
+  const auto command = getCommandIdForMessage(message);
+  if (command == LRCommandList::kNoCommand)
+    throw std::out_of_range("No command mapped to MIDI message");
+  return LRCommandList::getCommandString(command);
 }
 
 void CommandMap::removeMessage(const MIDI_Message &message) {
     // removes message from the message:command map, and its associated command from
     // the command:message map
-  command_string_map_.erase(message_map_[message]);
-  message_map_.erase(message);
+  {
+    std::lock_guard<decltype(write_mutex_)> lock(write_mutex_);
+    auto& table = Draft_();
+    const auto slot = FindSlot_(static_cast<const Table&>(table), message);
+    if (slot == nullptr || slot->command == LRCommandList::kNoCommand)
+      return;
+    table.command_messages[slot->command].channel = 0;
+    if (message.isNRPN)
+      table.sparse_table.erase(SparseKey_(message));
+    else
+      *FindSlot_(table, message) = kNoMapping;
+    table.mapped_count--;
+    if (!Commit_())
+      return;
+  }
+  Notify();
 }
 
-void CommandMap::clearMap() noexcept {
-  command_string_map_.clear();
-  message_map_.clear();
+void CommandMap::setCCModeForMessage(const MIDI_Message &message, CC_MODE mode) {
+  if (!message.isCC)
+    return;
+  {
+    std::lock_guard<decltype(write_mutex_)> lock(write_mutex_);
+    auto& table = Draft_();
+    const auto existing = FindSlot_(static_cast<const Table&>(table), message);
+    if (existing == nullptr || existing->command == LRCommandList::kNoCommand)
+      return;
+    FindSlot_(table, message)->mode = mode;
+    if (!Commit_())
+      return;
+  }
+  Notify();
 }
 
-bool CommandMap::messageExistsInMap(const MIDI_Message &message) const {
-  return message_map_.count(message) > 0 ? true : false;
+void CommandMap::setCCResolutionForMessage(const MIDI_Message &message,
+  CC_RESOLUTION resolution) {
+  if (!message.isCC || (resolution == CC_RESOLUTION::CC14 &&
+    (message.isNRPN || message.controller >= 32)))
+    return; // only CC 0-31 have an LSB
+  {
+    std::lock_guard<decltype(write_mutex_)> lock(write_mutex_);
+    auto& table = Draft_();
+    const auto existing = FindSlot_(static_cast<const Table&>(table), message);
+    if (existing == nullptr || existing->command == LRCommandList::kNoCommand)
+      return;
+    FindSlot_(table, message)->resolution = resolution;
+    if (!Commit_())
+      return;
+  }
+  Notify();
 }
 
-const MIDI_Message& CommandMap::getMessageForCommand(const String &command) const {
-  return command_string_map_.at(command);
+void CommandMap::setFeedbackFormatForMessage(const MIDI_Message &message,
+  FEEDBACK_FORMAT format) {
+  if (!message.isCC)
+    return;
+  {
+    std::lock_guard<decltype(write_mutex_)> lock(write_mutex_);
+    auto& table = Draft_();
+    const auto existing = FindSlot_(static_cast<const Table&>(table), message);
+    if (existing == nullptr || existing->command == LRCommandList::kNoCommand)
+      return;
+    FindSlot_(table, message)->feedback = format;
+    if (!Commit_())
+      return;
+  }
+  Notify();
 }
+
+void CommandMap::setTakeoverModeForMessage(const MIDI_Message &message,
+  TAKEOVER_MODE mode) {
+  if (!message.isCC)
+    return;
+  {
+    std::lock_guard<decltype(write_mutex_)> lock(write_mutex_);
+    auto& table = Draft_();
+    const auto existing = FindSlot_(static_cast<const Table&>(table), message);
+    if (existing == nullptr || existing->command == LRCommandList::kNoCommand)
+      return;
+    FindSlot_(table, message)->takeover = mode;
+    if (!Commit_())
+      return;
+  }
+  Notify();
+}
+
+void CommandMap::clearMap() {
+  {
+    std::lock_guard<decltype(write_mutex_)> lock(write_mutex_);
+    auto& table = Draft_();
+    for (auto& message : table.command_messages)
+      message.channel = 0;
+    table.message_tables.fill(nullptr);
+    table.message_tables[MIDIDeviceList::kAnyDevice] =
+      std::make_shared<MessageTable>();
+    table.message_tables[MIDIDeviceList::kAnyDevice]->fill(kNoMapping);
+    table.sparse_table.clear();
+    table.mapped_count = 0;
+    if (!Commit_())
+      return;
+  }
+  Notify();
+}
+
+bool CommandMap::messageExistsInMap(const MIDI_Message &message) const noexcept {
+  std::lock_guard<decltype(write_mutex_)> lock(write_mutex_);
+  const auto slot = FindSlot_(draft_ ? *draft_ : *current_.load(), message);
+  return slot && slot->command != LRCommandList::kNoCommand;
+}
+
+MIDI_Message CommandMap::getMessageForCommand(LRCommandId command) const {
+  MIDI_Message message;
+  if (!findMessageForCommand(command, message))
+    throw std::out_of_range("No MIDI message mapped to command");
+  return message;
+}
+
+MIDI_Message CommandMap::getMessageForCommand(const String &command) const {
+  return getMessageForCommand(LRCommandList::findCommandId(command));
+}
+
+bool CommandMap::findMessageForCommand(LRCommandId command,
+  MIDI_Message& message) const noexcept {
+  const ReadSnapshot table{*this};
+  if (command >= table->command_messages.size() ||
+    table->command_messages[command].channel == 0)
+    return false;
+  message = table->command_messages[command];
+  return true;
+}
+
+bool CommandMap::findFeedbackForCommand(LRCommandId command,
+  MIDI_Message& message, FEEDBACK_FORMAT& format) const noexcept {
+  const ReadSnapshot table{*this};
+  if (command >= table->command_messages.size() ||
+    table->command_messages[command].channel == 0)
+    return false;
+  message = table->command_messages[command];
+  const auto slot = FindSlot_(*table, message);
+  format = slot ? slot->feedback : DefaultFeedbackFormat(message);
+  return true;
+}
+
+bool CommandMap::commandHasAssociatedMessage(LRCommandId command) const noexcept {
+  MIDI_Message message;
+  return findMessageForCommand(command, message);
+}
+
 bool CommandMap::commandHasAssociatedMessage(const String &command) const {
-  return command_string_map_.count(command) > 0 ? true : false;
+  return commandHasAssociatedMessage(LRCommandList::findCommandId(command));
 }
+
 void CommandMap::toXMLDocument(File& file) const {
-  if (message_map_.size()) {//don't bother if map is empty
+  const ReadSnapshot table{*this};
+  if (table->mapped_count) {//don't bother if map is empty
     // save the contents of the command map to an xml file
     XmlElement root{"settings"};
-    for (auto map_entry : message_map_) {
+    const auto add_setting = [&root](MIDI_Message message,
+      const CommandMapping& mapping) {
+      message.isRelative = mapping.mode != CC_MODE::ABS;
       auto* setting = new XmlElement{"setting"};
-      setting->setAttribute("channel", map_entry.first.channel);
-      setting->setAttribute("NRPN", (map_entry.first.isNRPN) ? "True" : "False");
-      setting->setAttribute("Relative", (map_entry.first.isRelative) ? "True" : "False");
-      if (map_entry.first.isCC)
-        setting->setAttribute("controller", map_entry.first.controller);
+      if (message.device != MIDIDeviceList::kAnyDevice)
+        setting->setAttribute("device",
+          MIDIDeviceList::getDeviceName(message.device));
+      setting->setAttribute("channel", message.channel);
+      setting->setAttribute("NRPN", (message.isNRPN) ? "True" : "False");
+      setting->setAttribute("Relative", (message.isRelative) ? "True" : "False");
+      if (message.isRelative)
+        setting->setAttribute("RelativeMode", CCModeName(mapping.mode));
+      if (mapping.resolution != CC_RESOLUTION::CC7)
+        setting->setAttribute("Resolution", CCResolutionName(mapping.resolution));
+      if (mapping.feedback != DefaultFeedbackFormat(message))
+        setting->setAttribute("Feedback", FeedbackFormatName(mapping.feedback));
+      if (mapping.takeover != TAKEOVER_MODE::DEFAULT)
+        setting->setAttribute("Takeover", TakeoverModeName(mapping.takeover));
+      if (message.isCC)
+        setting->setAttribute("controller", message.controller);
       else
-        setting->setAttribute("note", map_entry.first.pitch);
-      setting->setAttribute("command_string", map_entry.second);
+        setting->setAttribute("note", message.pitch);
+      setting->setAttribute("command_string",
+        LRCommandList::getCommandString(mapping.command));
       root.addChildElement(setting);
+    };
+    for (auto device = 0; device < kDeviceCount; device++) {
+      if (!table->message_tables[device])
+        continue;
+      const auto& message_table = *table->message_tables[device];
+      for (auto index = 0; index < kTableSize; index++) {
+        if (message_table[index].command == LRCommandList::kNoCommand)
+          continue;
+        MIDI_Message message{index % (16 * 128) / 128 + 1, index % 128,
+          index >= 16 * 128};
+        message.device = device;
+        add_setting(message, message_table[index]);
+      }
+    }
+    for (const auto& sparse : table->sparse_table) {
+      if (sparse.second.command == LRCommandList::kNoCommand)
+        continue;
+      add_setting(MessageForSparseKey_(sparse.first), sparse.second);
     }
     if (!root.writeToFile(file, ""))
         // Give feedback if file-save doesn't work
       AlertWindow::showMessageBox(AlertWindow::WarningIcon, "File Save Error",
       "Unable to save file as specified. Please try again, and consider saving to a different location.");
   }
-}
\ No newline at end of file
+}
@@ -22,14 +22,22 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 
 #ifndef COMMANDMAP_H_INCLUDED
 #define COMMANDMAP_H_INCLUDED
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "LRCommands.h"
 #include "Pattern/Subject.h"
 
 struct MIDI_Message {
   bool isCC;
   bool isNRPN;
   bool isRelative;
+  int device; // see MIDIDeviceList, 0 matches any device
   int channel;
   union {
     int controller;
@@ -40,6 +48,7 @@ struct MIDI_Message {
   MIDI_Message(): isCC(0),
     isNRPN(0),
     isRelative(0),
+    device(0),
     channel(0),
     data(0)
 
@@ -49,23 +58,103 @@ struct MIDI_Message {
     isCC(iscc),
     data(dat),
     isNRPN(0),
-    isRelative(0) {}
+    isRelative(0),
+    device(0) {}
 
   bool operator==(const MIDI_Message &other) const {
-    return (isCC == other.isCC && channel == other.channel && data == other.data);
+    return (isCC == other.isCC && isNRPN == other.isNRPN &&
+      device == other.device && channel == other.channel && data == other.data);
   }
 };
 
-// hash functions for MIDI_Message and String
-namespace std {
-  template <>
-  struct hash<MIDI_Message> {
-    std::size_t operator()(const MIDI_Message& k) const noexcept {
-      return (std::hash<bool>()(k.isCC) ^ std::hash<int>()(k.channel) ^
-        (std::hash<int>()(k.data) << 1));
-    }
-  };
+// how a MIDI message is handled, decided once when its mapping is made
+enum class ACTION_KIND: uint8 {
+  LEARN_ONLY, // not in the map, only shown in the command table
+  UNMAPPED, // in the map, but mapped to "Unmapped"
+  SEND_TO_LR, // sent to the LR plugin
+  PREVIOUS_PROFILE,
+  NEXT_PROFILE,
+};
+
+// bit for an ACTION_KIND in a listener's set of kinds
+inline uint32 ActionKindMask(ACTION_KIND kind) noexcept {
+  return 1u << static_cast<uint32>(kind);
+}
+constexpr uint32 kAllActionKinds = 0xFFFFFFFF;
+
+// how the values of a mapped controller are read. Endless encoders send a
+// signed step per detent in one of the relative encodings
+enum class CC_MODE: uint8 {
+  ABS, // absolute position, 0 to max
+  TWOS_COMPLEMENT, // 1, 2, ... up, 127, 126, ... down
+  SIGN_MAGNITUDE, // 1, 2, ... up, 65, 66, ... down
+  BINARY_OFFSET, // 65, 66, ... up, 63, 62, ... down
+};
+
+// names of the modes in profile files. An unknown name is read as
+// TWOS_COMPLEMENT, the most common relative encoding
+String CCModeName(CC_MODE mode);
+CC_MODE CCModeFromName(const String& name);
+
+// signed step of a relative controller value, max_value is 127 or 16383
+int RelativeDelta(CC_MODE mode, int value, int max_value) noexcept;
+
+// how many bits a mapped controller sends, see ControllerDecoder. Only CC 0-31
+// can be 14-bit
+enum class CC_RESOLUTION: uint8 {
+  CC7, // one 7-bit CC
+  CC14, // MSB on CC 0-31, then LSB on that CC + 32
+};
+
+// names of the resolutions in profile files. An unknown name is read as CC7
+String CCResolutionName(CC_RESOLUTION resolution);
+CC_RESOLUTION CCResolutionFromName(const String& name);
+
+// how values from the plugin are sent back to a mapped controller, so motor
+// faders and LED rings can show more than 128 steps
+enum class FEEDBACK_FORMAT: uint8 {
+  CC7, // one 7-bit CC
+  CC14, // MSB on CC 0-31, then LSB on that CC + 32
+  NRPN, // CC 99/98 select the parameter, CC 6/38 carry the value
+  PITCH_BEND, // the channel's pitch wheel, ignores the controller number
+};
+
+// values sent back to a controller run 0-kMaxFeedbackValue whatever the
+// format, 127 in the plugin's scale is 16383
+constexpr int kMaxFeedbackValue = 16383;
+
+// names of the formats in profile files. An unknown name is read as CC7
+String FeedbackFormatName(FEEDBACK_FORMAT format);
+FEEDBACK_FORMAT FeedbackFormatFromName(const String& name);
+
+// format a newly mapped message starts with, NRPN for an NRPN
+FEEDBACK_FORMAT DefaultFeedbackFormat(const MIDI_Message& message) noexcept;
+
+// how an absolute controller takes over a parameter it doesn't show the value
+// of, see Takeover
+enum class TAKEOVER_MODE: uint8 {
+  DEFAULT, // PICKUP or JUMP, following the pickup setting
+  PICKUP, // ignored until the controller reaches the parameter's value
+  SCALE, // moves the parameter proportionally until they meet
+  JUMP, // the parameter follows the controller at once
+};
+
+// names of the modes in profile files. An unknown name is read as DEFAULT
+String TakeoverModeName(TAKEOVER_MODE mode);
+TAKEOVER_MODE TakeoverModeFromName(const String& name);
+
+// result of resolving a MIDI message against the map
+struct CommandMapping {
+  LRCommandId command;
+  ACTION_KIND kind;
+  CC_MODE mode;
+  CC_RESOLUTION resolution;
+  FEEDBACK_FORMAT feedback;
+  TAKEOVER_MODE takeover;
+};
 
+// hash function for String
+namespace std {
   template <>
   struct hash<String> {
     std::size_t operator()(const String& k) const noexcept {
@@ -74,20 +163,37 @@ namespace std {
   };
 }
 
+// Readers never lock: each read works on an immutable snapshot reached through
+// an atomic pointer. Writers serialize on a mutex, change a private copy and
+// publish it with one pointer swap. Replaced snapshots are freed by a later
+// write once no reader is inside the map. Observers are told after each
+// publish, on the writing thread once it has released the write lock, so they
+// may read or change the map.
 class CommandMap: public Subject {
 public:
   CommandMap() noexcept;
-  virtual ~CommandMap() {}
+  virtual ~CommandMap();
+
+  // mapping of a message that isn't in the map
+  static const CommandMapping kNoMapping;
 
 // adds an entry to the message:command map, and a corresponding entry to the
-// command:message map will look up the string by the index (but it is preferred to
-// directly use the String)
-  void addCommandforMessage(unsigned int command, const MIDI_Message &cc);
+// command:message map
+  void addCommandforMessage(LRCommandId command, const MIDI_Message &cc);
 
   // adds an entry to the message:command map, and a corresponding entry to the
-  // command:message map
+  // command:message map. Registers the command if LRCommandList doesn't know it
   void addCommandforMessage(const String &command, const MIDI_Message &cc);
 
+  // gets the id of the LR command associated to a MIDI message, or
+  // LRCommandList::kNoCommand if the message isn't mapped
+  LRCommandId getCommandIdForMessage(const MIDI_Message &message) const noexcept;
+
+  // gets the command and the kind of action for a MIDI message in one lookup.
+  // A message from a device without its own mapping gets the mapping for any
+  // device
+  CommandMapping getMappingForMessage(const MIDI_Message &message) const noexcept;
+
   // gets the LR command associated to a MIDI message
   const String& getCommandforMessage(const MIDI_Message &message) const;
 
@@ -95,25 +201,130 @@ class CommandMap: public Subject {
   // removes a MIDI message from the message:command map, and it's associated entry
   void removeMessage(const MIDI_Message &message);
 
+  // sets how the values of a mapped CC are read, a message that isn't mapped
+  // is left alone
+  void setCCModeForMessage(const MIDI_Message &message, CC_MODE mode);
+
+  // sets how many bits a mapped CC sends, a message that isn't mapped or CC14
+  // for a controller without an LSB is left alone
+  void setCCResolutionForMessage(const MIDI_Message &message,
+    CC_RESOLUTION resolution);
+
+  // sets how feedback is sent to a mapped CC, a message that isn't mapped is
+  // left alone
+  void setFeedbackFormatForMessage(const MIDI_Message &message,
+    FEEDBACK_FORMAT format);
+
+  // sets how a mapped CC takes over its parameter, a message that isn't
+  // mapped is left alone
+  void setTakeoverModeForMessage(const MIDI_Message &message,
+    TAKEOVER_MODE mode);
+
   // clears both message:command and command:message maps
-  void clearMap() noexcept;
+  void clearMap();
 
-  // returns true if there is a mapping for a particular MIDI message
-  bool messageExistsInMap(const MIDI_Message &message) const;
+  // changes made between beginUpdate and endUpdate are published together
+  // when endUpdate is called, so readers see all of them or none
+  void beginUpdate();
+  void endUpdate();
+
+  // returns true if there is a mapping for a particular MIDI message, including
+  // changes not yet published by endUpdate
+  bool messageExistsInMap(const MIDI_Message &message) const noexcept;
 
   // gets the MIDI message associated to a LR command
-  const MIDI_Message& getMessageForCommand(const String &command) const;
+  MIDI_Message getMessageForCommand(LRCommandId command) const;
+  MIDI_Message getMessageForCommand(const String &command) const;
+
+  // gets the MIDI message associated to a LR command, returns false if there
+  // isn't one. Use instead of commandHasAssociatedMessage followed by
+  // getMessageForCommand when the map may change in between
+  bool findMessageForCommand(LRCommandId command,
+    MIDI_Message& message) const noexcept;
+
+  // gets the MIDI message associated to a LR command and how feedback is sent
+  // to it, from one version of the map. Returns false if there isn't one
+  bool findFeedbackForCommand(LRCommandId command, MIDI_Message& message,
+    FEEDBACK_FORMAT& format) const noexcept;
 
   // returns true if there is a mapping for a particular LR command
+  bool commandHasAssociatedMessage(LRCommandId command) const noexcept;
   bool commandHasAssociatedMessage(const String &command) const;
 
   // saves the message:command map as an XML file
   void toXMLDocument(File& file) const;
 
 private:
+  static constexpr int kTableSize = 2 * 16 * 128;
+  static constexpr int kDeviceCount = 256; // MIDIDeviceList ids fit in a byte
+  using MessageTable = std::array<CommandMapping, kTableSize>;
+
+  // one published version of the map
+  struct Table {
+    Table();
+    // a flat table per device id, one slot per CC/note x channel x number
+    // holding the command id and its action kind, so a lookup is a single
+    // array load. The table for any device always exists, a device's own is
+    // made with its first mapping. Versions share the tables not changed
+    // since, see FindSlot_
+    std::array<std::shared_ptr<MessageTable>, kDeviceCount> message_tables;
+    size_t mapped_count{0};
+    // NRPNs, with their 14-bit numbers, would make the flat tables too big,
+    // keyed by SparseKey_
+    std::map<int, CommandMapping> sparse_table;
+    // indexed by command id, channel 0 marks a command without a message
+    std::vector<MIDI_Message> command_messages;
+  };
+
+  // keeps the current table alive for as long as it is in scope
+  class ReadSnapshot {
+  public:
+    explicit ReadSnapshot(const CommandMap& map) noexcept;
+    ~ReadSnapshot();
+    const Table* operator->() const noexcept {
+      return table_;
+    }
+    const Table& operator*() const noexcept {
+      return *table_;
+    }
+  private:
+    const CommandMap& map_;
+    const Table* table_;
+  };
+
+  // position of a message in its device's message table, or -1 if outside the
+  // 7-bit CC/note address space or an NRPN
+  static int TableIndex_(const MIDI_Message& message) noexcept;
+
+  // key of a message in sparse_table, or -1 if it belongs in a message table
+  // or is invalid
+  static int SparseKey_(const MIDI_Message& message) noexcept;
+
+  // inverse of SparseKey_
+  static MIDI_Message MessageForSparseKey_(int key) noexcept;
+
+  // the slot a message maps to in table, nullptr if it has none. The const
+  // version never inserts, the other makes the device's message table if
+  // needed and copies it first if another version shares it
+  static CommandMapping* FindSlot_(Table& table, const MIDI_Message& message);
+  static const CommandMapping* FindSlot_(const Table& table,
+    const MIDI_Message& message) noexcept;
+
+  // returns the copy writers change, making it from the current table if
+  // needed. Called with write_mutex_ held
+  Table& Draft_();
+
+  // publishes the draft unless inside beginUpdate/endUpdate, returns true if it
+  // did. Called with write_mutex_ held, the caller then notifies the observers
+  // once it has released it
+  bool Commit_();
 
-  std::unordered_map<MIDI_Message, String> message_map_;
-  std::unordered_map<String, MIDI_Message> command_string_map_;
+  std::atomic<const Table*> current_;
+  mutable std::atomic<int> readers_{0};
+  mutable std::mutex write_mutex_;
+  std::unique_ptr<Table> draft_;
+  std::vector<std::unique_ptr<const Table>> retired_;
+  int update_depth_{0};
 };
 
 #endif  // COMMANDMAP_H_INCLUDED
@@ -23,6 +23,26 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 #include <limits>
 #include "LRCommands.h"
 
+namespace {
+  // menu ids of the controller types, above any command's id
+  constexpr auto kModeItemBase = 0x10000;
+  const char* const kModeItemNames[] = {"Absolute",
+    "Relative (Two's Complement)", "Relative (Sign Magnitude)",
+    "Relative (Binary Offset)"};
+  // menu ids of the feedback formats, above the controller types
+  constexpr auto kFeedbackItemBase = 0x20000;
+  const char* const kFeedbackItemNames[] = {"7-bit CC", "14-bit CC",
+    "NRPN", "Pitch Bend"};
+  // menu ids of the takeover modes, above the feedback formats
+  constexpr auto kTakeoverItemBase = 0x30000;
+  const char* const kTakeoverItemNames[] = {"As Pickup Setting", "Pickup",
+    "Scale", "Jump"};
+  // menu ids of the controller resolutions, above the takeover modes
+  constexpr auto kResolutionItemBase = 0x40000;
+  const char* const kResolutionItemNames[] = {"7-bit",
+    "14-bit (MSB + LSB on CC + 32)"};
+}
+
 CommandMenu::CommandMenu(const MIDI_Message& message):
   message_{message},
   TextButton{"Unmapped"},
@@ -54,10 +74,7 @@ void CommandMenu::setMsg(const MIDI_Message& message) noexcept {
 
 void CommandMenu::setSelectedItem(unsigned int index) {
   selected_item_ = index;
-  if (index - 1 < LRCommandList::LRStringList.size())
-    setButtonText(LRCommandList::LRStringList[index - 1]);
-  else
-    setButtonText(LRCommandList::NextPrevProfile[index - 1 - LRCommandList::LRStringList.size()]);
+  setButtonText(LRCommandList::getCommandString(static_cast<LRCommandId>(index - 1)));
 }
 
 void CommandMenu::buttonClicked(Button* /*button*/) {
@@ -74,7 +91,7 @@ void CommandMenu::buttonClicked(Button* /*button*/) {
       auto already_mapped = false;
       if ((index - 1 < LRCommandList::LRStringList.size()) && (command_map_)) {
         already_mapped =
-          command_map_->commandHasAssociatedMessage(LRCommandList::LRStringList[index - 1]);
+          command_map_->commandHasAssociatedMessage(static_cast<LRCommandId>(index - 1));
       }
 
       // add each submenu entry, ticking the previously selected entry and
@@ -95,21 +112,94 @@ void CommandMenu::buttonClicked(Button* /*button*/) {
     submenu_tick_set |= (selected_item_ < index && !submenu_tick_set);
   }
 
+  // endless encoders, only for controllers that are mapped
+  const auto mapping = command_map_ ? command_map_->getMappingForMessage(message_) :
+    CommandMap::kNoMapping;
+  if (message_.isCC && mapping.command != LRCommandList::kNoCommand) {
+    PopupMenu mode_menu;
+    for (const auto mode : {CC_MODE::ABS, CC_MODE::TWOS_COMPLEMENT,
+      CC_MODE::SIGN_MAGNITUDE, CC_MODE::BINARY_OFFSET}) {
+      mode_menu.addItem(kModeItemBase + static_cast<int>(mode),
+        kModeItemNames[static_cast<int>(mode)], true, mode == mapping.mode);
+    }
+    main_menu.addSeparator();
+    main_menu.addSubMenu("Controller Type", mode_menu, true, nullptr,
+      mapping.mode != CC_MODE::ABS);
+
+    // how many bits the controller sends, only CC 0-31 have an LSB
+    PopupMenu resolution_menu;
+    const auto can_pair = !message_.isNRPN && message_.controller < 32;
+    for (const auto resolution : {CC_RESOLUTION::CC7, CC_RESOLUTION::CC14}) {
+      resolution_menu.addItem(kResolutionItemBase + static_cast<int>(resolution),
+        kResolutionItemNames[static_cast<int>(resolution)],
+        can_pair || resolution == CC_RESOLUTION::CC7,
+        resolution == mapping.resolution);
+    }
+    main_menu.addSubMenu("Resolution", resolution_menu, true, nullptr,
+      mapping.resolution != CC_RESOLUTION::CC7);
+
+    // resolution of the values shown on motor faders and LED rings
+    PopupMenu feedback_menu;
+    for (const auto format : {FEEDBACK_FORMAT::CC7, FEEDBACK_FORMAT::CC14,
+      FEEDBACK_FORMAT::NRPN, FEEDBACK_FORMAT::PITCH_BEND}) {
+      feedback_menu.addItem(kFeedbackItemBase + static_cast<int>(format),
+        kFeedbackItemNames[static_cast<int>(format)], true,
+        format == mapping.feedback);
+    }
+    main_menu.addSubMenu("Feedback", feedback_menu, true, nullptr,
+      mapping.feedback != DefaultFeedbackFormat(message_));
+
+    // what an absolute controller does when it doesn't match its parameter
+    PopupMenu takeover_menu;
+    for (const auto mode : {TAKEOVER_MODE::DEFAULT, TAKEOVER_MODE::PICKUP,
+      TAKEOVER_MODE::SCALE, TAKEOVER_MODE::JUMP}) {
+      takeover_menu.addItem(kTakeoverItemBase + static_cast<int>(mode),
+        kTakeoverItemNames[static_cast<int>(mode)], true,
+        mode == mapping.takeover);
+    }
+    main_menu.addSubMenu("Takeover", takeover_menu,
+      mapping.mode == CC_MODE::ABS, nullptr,
+      mapping.takeover != TAKEOVER_MODE::DEFAULT);
+  }
+
   auto result = static_cast<size_t>(main_menu.show());
-  if ((result) && (command_map_)) {
+  if (result >= static_cast<size_t>(kResolutionItemBase) && command_map_) {
+    command_map_->setCCResolutionForMessage(message_,
+      static_cast<CC_RESOLUTION>(result - static_cast<size_t>(kResolutionItemBase)));
+  }
+  else if (result >= static_cast<size_t>(kTakeoverItemBase) && command_map_) {
+    command_map_->setTakeoverModeForMessage(message_,
+      static_cast<TAKEOVER_MODE>(result - static_cast<size_t>(kTakeoverItemBase)));
+  }
+  else if (result >= static_cast<size_t>(kFeedbackItemBase) && command_map_) {
+    command_map_->setFeedbackFormatForMessage(message_,
+      static_cast<FEEDBACK_FORMAT>(result - static_cast<size_t>(kFeedbackItemBase)));
+  }
+  else if (result >= static_cast<size_t>(kModeItemBase) && command_map_) {
+    command_map_->setCCModeForMessage(message_,
+      static_cast<CC_MODE>(result - static_cast<size_t>(kModeItemBase)));
+  }
+  else if ((result) && (command_map_)) {
       // user chose a different command, remove previous command mapping
       // associated to this menu
+    command_map_->beginUpdate();
     if (selected_item_ < std::numeric_limits<unsigned int>::max())
       command_map_->removeMessage(message_);
 
-    if (result - 1 < LRCommandList::LRStringList.size())
-      setButtonText(LRCommandList::LRStringList[result - 1]);
-    else
-      setButtonText(LRCommandList::NextPrevProfile[result - 1 - LRCommandList::LRStringList.size()]);
+    const auto command = static_cast<LRCommandId>(result - 1);
+    setButtonText(LRCommandList::getCommandString(command));
 
     selected_item_ = result;
 
-    // Map the selected command to the CC
-    command_map_->addCommandforMessage(result - 1, message_);
+    // Map the selected command to the CC, keeping the controller type,
+    // resolution, feedback format and takeover mode
+    command_map_->addCommandforMessage(command, message_);
+    command_map_->setCCModeForMessage(message_, mapping.mode);
+    if (mapping.command != LRCommandList::kNoCommand) {
+      command_map_->setCCResolutionForMessage(message_, mapping.resolution);
+      command_map_->setFeedbackFormatForMessage(message_, mapping.feedback);
+      command_map_->setTakeoverModeForMessage(message_, mapping.takeover);
+    }
+    command_map_->endUpdate();
   }
 }
@@ -20,6 +20,7 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "CommandTableModel.h"
 #include "LRCommands.h"
+#include "MIDIDeviceList.h"
 
 CommandTableModel::CommandTableModel() noexcept {}
 
@@ -45,12 +46,18 @@ void CommandTableModel::paintCell(Graphics &g, int row_number, int column_id,
 
   if (column_id == 1) // write the MIDI message in the MIDI command column
   {
-    if (commands_[row_number].isCC)
-      g.drawText(String::formatted("%d | CC: %d", commands_[row_number].channel,
-      commands_[row_number].controller), 0, 0, width, height, Justification::centred);
+    const auto& message = commands_[row_number];
+    String text;
+    if (message.isNRPN)
+      text = String::formatted("%d | NRPN: %d", message.channel, message.controller);
+    else if (message.isCC)
+      text = String::formatted("%d | CC: %d", message.channel, message.controller);
     else
-      g.drawText(String::formatted("%d | Note: %d", commands_[row_number].channel,
-      commands_[row_number].pitch), 0, 0, width, height, Justification::centred);
+      text = String::formatted("%d | Note: %d", message.channel, message.pitch);
+    // mappings for a single device show its name
+    if (message.device != MIDIDeviceList::kAnyDevice)
+      text = MIDIDeviceList::getDeviceName(message.device) + " | " + text;
+    g.drawText(text, 0, 0, width, height, Justification::centred);
   }
 }
 
@@ -71,8 +78,8 @@ Component *CommandTableModel::refreshComponentForCell(int row_number,
 
     if (command_map_) {
         // add 1 because 0 is reserved for no selection
-      command_select->setSelectedItem(LRCommandList::getIndexOfCommand(command_map_->
-        getCommandforMessage(commands_[row_number])) + 1);
+      command_select->setSelectedItem(command_map_->
+        getCommandIdForMessage(commands_[row_number]) + 1u);
     }
 
     return command_select;
@@ -81,12 +88,11 @@ Component *CommandTableModel::refreshComponentForCell(int row_number,
     return nullptr;
 }
 
-void CommandTableModel::addRow(int midi_channel, int midi_data, bool is_cc) {
-  MIDI_Message msg{midi_channel, midi_data, is_cc};
+void CommandTableModel::addRow(const MIDI_Message& msg) {
   if (command_map_) {
     if (!command_map_->messageExistsInMap(msg)) {
       commands_.push_back(msg);
-      command_map_->addCommandforMessage(0, msg); // add an entry for 'no command'
+      command_map_->addCommandforMessage(LRCommandList::kUnmapped, msg); // add an entry for 'no command'
       rows_++;
     }
   }
@@ -115,6 +121,10 @@ void CommandTableModel::buildFromXml(const XmlElement * const root) {
   if (root->getTagName().compare("settings") != 0)
     return;
 
+  // readers switch to the new profile in one step
+  if (command_map_)
+    command_map_->beginUpdate();
+
   removeAllRows();
 
   auto* setting = root->getFirstChildElement();
@@ -122,27 +132,44 @@ void CommandTableModel::buildFromXml(const XmlElement * const root) {
     if (setting->hasAttribute("controller")) {
       MIDI_Message message{setting->getIntAttribute("channel"),
         setting->getIntAttribute("controller"), true};
-      addRow(message.channel, message.controller, true);
+      message.isNRPN = setting->getStringAttribute("NRPN") == "True";
+      message.device = MIDIDeviceList::getDeviceId(
+        setting->getStringAttribute("device"));
+      addRow(message);
 
       // older versions of MIDI2LR stored the index of the string, so we should attempt to parse this as well
       if (setting->getIntAttribute("command", -1) != -1) {
-        command_map_->addCommandforMessage(setting->
-          getIntAttribute("command"), message);
+        command_map_->addCommandforMessage(static_cast<LRCommandId>(setting->
+          getIntAttribute("command")), message);
       }
       else {
         command_map_->addCommandforMessage(setting->
           getStringAttribute("command_string"), message);
       }
+      if (setting->getStringAttribute("Relative") == "True")
+        command_map_->setCCModeForMessage(message,
+          CCModeFromName(setting->getStringAttribute("RelativeMode")));
+      if (setting->hasAttribute("Resolution"))
+        command_map_->setCCResolutionForMessage(message,
+          CCResolutionFromName(setting->getStringAttribute("Resolution")));
+      if (setting->hasAttribute("Feedback"))
+        command_map_->setFeedbackFormatForMessage(message,
+          FeedbackFormatFromName(setting->getStringAttribute("Feedback")));
+      if (setting->hasAttribute("Takeover"))
+        command_map_->setTakeoverModeForMessage(message,
+          TakeoverModeFromName(setting->getStringAttribute("Takeover")));
     }
     else if (setting->hasAttribute("note")) {
       MIDI_Message note{setting->getIntAttribute("channel"),
         setting->getIntAttribute("note"), false};
-      addRow(note.channel, note.pitch, false);
+      note.device = MIDIDeviceList::getDeviceId(
+        setting->getStringAttribute("device"));
+      addRow(note);
 
       // older versions of MIDI2LR stored the index of the string, so we should attempt to parse this as well
       if (setting->getIntAttribute("command", -1) != -1) {
-        command_map_->addCommandforMessage(setting->getIntAttribute("command"),
-          note);
+        command_map_->addCommandforMessage(static_cast<LRCommandId>(setting->
+          getIntAttribute("command")), note);
       }
       else {
         command_map_->addCommandforMessage(setting->
@@ -151,14 +178,22 @@ void CommandTableModel::buildFromXml(const XmlElement * const root) {
     }
     setting = setting->getNextElement();
   }
+
+  if (command_map_)
+    command_map_->endUpdate();
 }
 
-int CommandTableModel::getRowForMessage(int midi_channel, int midi_data, bool is_cc) const {
+int CommandTableModel::getRowForMessage(const MIDI_Message& message) const {
   for (auto idx = 0; idx < rows_; idx++) {
-    if (commands_[idx].channel == midi_channel && commands_[idx].controller == midi_data
-      && commands_[idx].isCC == is_cc)
+    if (commands_[idx] == message)
       return idx;
   }
+  if (message.device != MIDIDeviceList::kAnyDevice) {
+      // no row for this device, use the one for any device as CommandMap does
+    auto any_device = message;
+    any_device.device = MIDIDeviceList::kAnyDevice;
+    return getRowForMessage(any_device);
+  }
   //could not find
   return -1;
 }
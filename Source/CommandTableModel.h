@@ -43,7 +43,7 @@ class CommandTableModel: public TableListBoxModel {
     bool isRowSelected, Component *existingComponentToUpdate) override;
 
   // adds a row with a corresponding MIDI message to the table
-  void addRow(int midi_channel, int midi_data, bool isCC);
+  void addRow(const MIDI_Message& message);
 
   // removes a row from the table
   void removeRow(int row);
@@ -54,8 +54,9 @@ class CommandTableModel: public TableListBoxModel {
   // builds the table from an XML file
   void buildFromXml(const XmlElement * const elem);
 
-  // returns the index of the row associated to a particular MIDI message
-  int getRowForMessage(int midi_channel, int midi_data, bool isCC) const;
+  // returns the index of the row associated to a particular MIDI message, or
+  // to the message from any device if its device has no row of its own
+  int getRowForMessage(const MIDI_Message& message) const;
 
 private:
   int rows_{0};
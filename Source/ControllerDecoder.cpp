@@ -0,0 +1,196 @@
+/*
+  ==============================================================================
+
+    ControllerDecoder.cpp
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#include "ControllerDecoder.h"
+
+namespace {
+  constexpr auto kMax7Bit = 127;
+  constexpr auto kMax14Bit = 16383;
+  constexpr auto kDataEntryMsb = 6;
+  constexpr auto kDataEntryLsb = 38;
+  constexpr auto kNrpnMsb = 99;
+  constexpr auto kNrpnLsb = 98;
+  constexpr auto kRpnMsb = 101;
+  constexpr auto kRpnLsb = 100;
+  constexpr auto kLsbOffset = 32;
+
+  ControllerDecoder::Event ControllerEvent(int midi_channel, int controller,
+    int value, int max_value) {
+    return {MIDI_Message{midi_channel, controller, true}, value, max_value};
+  }
+}
+
+ControllerDecoder::ControllerDecoder() noexcept {
+  for (auto& state : channels_) {
+    state.msbs.fill(-1);
+    state.deadlines.fill(0.0);
+  }
+}
+
+void ControllerDecoder::process(int midi_channel, int controller, int value,
+  bool fourteen_bit, double timestamp, std::vector<Event>& out) {
+  if (midi_channel < 1 || midi_channel > 16)
+    return;
+  auto& state = channels_[midi_channel - 1];
+  const auto parameter_selected = state.parameter_msb >= 0 &&
+    state.parameter_lsb >= 0;
+
+  switch (controller) {
+    case kNrpnMsb:
+    case kNrpnLsb:
+    case kRpnMsb:
+    case kRpnLsb:
+      // a new parameter ends any data still held for the old one
+      FlushChannel_(midi_channel, state, 0.0, out);
+      (controller == kNrpnMsb || controller == kRpnMsb ? state.parameter_msb :
+        state.parameter_lsb) = value;
+      state.parameter_is_rpn = (controller == kRpnMsb || controller == kRpnLsb);
+      state.data_msb = -1;
+      // RPN 127/127 is the null parameter, deselecting
+      if (state.parameter_is_rpn && state.parameter_msb == 127 &&
+        state.parameter_lsb == 127)
+        state.parameter_msb = state.parameter_lsb = -1;
+      return;
+    case kDataEntryMsb:
+      if (!parameter_selected)
+        break;
+      if (state.data_pending) {
+        state.data_pending = false;
+        EmitData_(midi_channel, state, state.data_msb << 7, out);
+      }
+      state.data_msb = value;
+      if (state.data_has_lsb) {
+        state.data_pending = true; // wait for CC 38
+        state.data_deadline = timestamp + kLsbTimeout;
+        ArmDeadline_(state.data_deadline);
+      }
+      else
+        EmitData_(midi_channel, state, value << 7, out);
+      return;
+    case kDataEntryLsb:
+      if (!parameter_selected || state.data_msb < 0)
+        break;
+      state.data_has_lsb = true;
+      state.data_pending = false;
+      EmitData_(midi_channel, state, (state.data_msb << 7) | value, out);
+      return;
+    default:
+      break;
+  }
+
+  if (controller < kLsbOffset) {
+    const auto bit = 1u << controller;
+    if (!fourteen_bit) {
+      state.fourteen_bit_msbs &= ~bit;
+      out.push_back(ControllerEvent(midi_channel, controller, value, kMax7Bit));
+      return;
+    }
+    state.fourteen_bit_msbs |= bit;
+    if (state.pending_msbs & bit) // previous MSB never got its LSB
+      out.push_back(ControllerEvent(midi_channel, controller,
+        state.msbs[controller] << 7, kMax14Bit));
+    state.msbs[controller] = value;
+    state.pending_msbs |= bit;
+    state.deadlines[controller] = timestamp + kLsbTimeout;
+    ArmDeadline_(state.deadlines[controller]);
+    return;
+  }
+  if (isFourteenBitLsb(midi_channel, controller)) {
+      // a device may send the LSB alone while the MSB doesn't change
+    const auto msb_controller = controller - kLsbOffset;
+    state.pending_msbs &= ~(1u << msb_controller);
+    out.push_back(ControllerEvent(midi_channel, msb_controller,
+      (state.msbs[msb_controller] << 7) | value, kMax14Bit));
+    return;
+  }
+  out.push_back(ControllerEvent(midi_channel, controller, value, kMax7Bit));
+}
+
+bool ControllerDecoder::isFourteenBitLsb(int midi_channel,
+  int controller) const noexcept {
+  if (midi_channel < 1 || midi_channel > 16 || controller < kLsbOffset ||
+    controller >= 2 * kLsbOffset)
+    return false;
+  const auto& state = channels_[midi_channel - 1];
+  const auto msb_controller = controller - kLsbOffset;
+  return (state.fourteen_bit_msbs & (1u << msb_controller)) &&
+    state.msbs[msb_controller] >= 0;
+}
+
+void ControllerDecoder::flushExpired(double now, std::vector<Event>& out) {
+  if (next_deadline_ <= 0.0 || now < next_deadline_)
+    return;
+  for (auto channel = 0; channel < 16; channel++)
+    FlushChannel_(channel + 1, channels_[channel], now, out);
+  UpdateDeadline_();
+}
+
+double ControllerDecoder::nextDeadline() const noexcept {
+  return next_deadline_;
+}
+
+void ControllerDecoder::ArmDeadline_(double deadline) noexcept {
+  if (next_deadline_ <= 0.0 || deadline < next_deadline_)
+    next_deadline_ = deadline;
+}
+
+void ControllerDecoder::UpdateDeadline_() noexcept {
+  next_deadline_ = 0.0;
+  for (const auto& state : channels_) {
+    if (state.data_pending && (next_deadline_ <= 0.0 ||
+      state.data_deadline < next_deadline_))
+      next_deadline_ = state.data_deadline;
+    for (auto controller = 0; controller < kLsbOffset; controller++) {
+      if ((state.pending_msbs & (1u << controller)) && (next_deadline_ <= 0.0 ||
+        state.deadlines[controller] < next_deadline_))
+        next_deadline_ = state.deadlines[controller];
+    }
+  }
+}
+
+void ControllerDecoder::EmitData_(int midi_channel, ChannelState& state,
+  int value, std::vector<Event>& out) const {
+    // RPNs set up the sending device, they aren't controls to map
+  if (state.parameter_is_rpn)
+    return;
+  Event event{MIDI_Message{midi_channel,
+    (state.parameter_msb << 7) | state.parameter_lsb, true}, value, kMax14Bit};
+  event.message.isNRPN = true;
+  out.push_back(event);
+}
+
+void ControllerDecoder::FlushChannel_(int midi_channel, ChannelState& state,
+  double now, std::vector<Event>& out) {
+  const auto expired = [now](double deadline) {
+    return now <= 0.0 || deadline <= now;
+  };
+  if (state.data_pending && expired(state.data_deadline)) {
+    state.data_pending = false;
+    EmitData_(midi_channel, state, state.data_msb << 7, out);
+  }
+  for (auto controller = 0; controller < kLsbOffset; controller++) {
+    const auto bit = 1u << controller;
+    if ((state.pending_msbs & bit) && expired(state.deadlines[controller])) {
+      state.pending_msbs &= ~bit;
+      out.push_back(ControllerEvent(midi_channel, controller,
+        state.msbs[controller] << 7, kMax14Bit));
+    }
+  }
+}
@@ -0,0 +1,98 @@
+#pragma once
+/*
+  ==============================================================================
+
+    ControllerDecoder.h
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#ifndef CONTROLLERDECODER_H_INCLUDED
+#define CONTROLLERDECODER_H_INCLUDED
+
+#include <array>
+#include <vector>
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "CommandMap.h"
+
+// Turns the CC stream of one device into controller events. 14-bit controllers
+// (MSB on CC 0-31 followed by its LSB on CC 32-63) and NRPN data entry
+// (CC 99/98 then 6/38) come out as one event with a 14-bit value instead of
+// several unrelated 7-bit ones. Everything else passes through unchanged.
+// Only controllers the caller says are 14-bit are paired, so CC 32-63 stay
+// free for ordinary controls. An MSB waits for its LSB until kLsbTimeout
+// after it arrived, then goes out alone. Whether an LSB is paired follows what
+// the caller said for its MSB's last message.
+class ControllerDecoder {
+public:
+  static constexpr double kLsbTimeout = 5.0; // milliseconds
+
+  struct Event {
+    MIDI_Message message; // isNRPN set for NRPN, data is the parameter number
+    int value;
+    int max_value; // 127 or 16383
+  };
+
+  ControllerDecoder() noexcept;
+
+  // feeds one CC message that arrived at timestamp, appending any event it
+  // completes to out. fourteen_bit tells whether a CC 0-31 is mapped as a
+  // 14-bit controller, it is ignored for other controllers. Times are
+  // milliseconds on the LatencyStats::now() clock
+  void process(int midi_channel, int controller, int value, bool fourteen_bit,
+    double timestamp, std::vector<Event>& out);
+
+  // true if the CC is the LSB of a 14-bit controller, it then only completes
+  // an event for its MSB
+  bool isFourteenBitLsb(int midi_channel, int controller) const noexcept;
+
+  // emits MSBs whose LSB hasn't arrived by their deadline
+  void flushExpired(double now, std::vector<Event>& out);
+
+  // time by which flushExpired should next be called, 0 if nothing is waiting.
+  // It can be early, never late
+  double nextDeadline() const noexcept;
+
+private:
+  struct ChannelState {
+    int parameter_msb{-1}; // selected by CC 99 or 101
+    int parameter_lsb{-1}; // selected by CC 98 or 100
+    bool parameter_is_rpn{false};
+    int data_msb{-1}; // last data entry MSB (CC 6)
+    bool data_pending{false}; // data_msb not yet emitted
+    bool data_has_lsb{false}; // device sends CC 38 after CC 6
+    double data_deadline{0.0};
+    uint32 pending_msbs{0}; // bit per CC 0-31 waiting for its LSB
+    uint32 fourteen_bit_msbs{0}; // bit per CC 0-31 last said to be 14-bit
+    std::array<int, 32> msbs;
+    std::array<double, 32> deadlines;
+  };
+
+  void EmitData_(int midi_channel, ChannelState& state, int value,
+    std::vector<Event>& out) const;
+  // emits what is waiting on the channel with a deadline up to now, pass a
+  // now of 0 to emit all of it
+  void FlushChannel_(int midi_channel, ChannelState& state, double now,
+    std::vector<Event>& out);
+  void ArmDeadline_(double deadline) noexcept;
+  void UpdateDeadline_() noexcept;
+
+  std::array<ChannelState, 16> channels_;
+  // never later than the earliest deadline, can be earlier once an LSB has
+  // arrived, flushExpired then finds nothing and recomputes it
+  double next_deadline_{0.0};
+};
+
+#endif  // CONTROLLERDECODER_H_INCLUDED
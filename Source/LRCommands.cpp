@@ -19,6 +19,12 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
   ==============================================================================
 */
 #include "LRCommands.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <unordered_map>
 #include "CommandMap.h"
 
@@ -1021,18 +1027,352 @@ const std::vector<String> LRCommandList::NextPrevProfile = {
   "Next Profile",
 };
 
-int LRCommandList::getIndexOfCommand(const String& command) {
-  static std::unordered_map<String, int> indexMap;
+const std::vector<String> LRCommandList::DevelopParameters = {
+    /* Basic Tone */
+    "Temperature",
+    "Tint",
+    "Exposure",
+    "Contrast",
+    "Highlights",
+    "Brightness",
+    "Shadows",
+    "Whites",
+    "Blacks",
+    "Clarity",
+    "Vibrance",
+    "Saturation",
+    /* Tone Curve */
+    "ParametricDarks",
+    "ParametricLights",
+    "ParametricShadows",
+    "ParametricHighlights",
+    "ParametricShadowSplit",
+    "ParametricMidtoneSplit",
+    "ParametricHighlightSplit",
+    /* Color Adjustments */
+    "SaturationAdjustmentRed",
+    "SaturationAdjustmentOrange",
+    "SaturationAdjustmentYellow",
+    "SaturationAdjustmentGreen",
+    "SaturationAdjustmentAqua",
+    "SaturationAdjustmentBlue",
+    "SaturationAdjustmentPurple",
+    "SaturationAdjustmentMagenta",
+    "HueAdjustmentRed",
+    "HueAdjustmentOrange",
+    "HueAdjustmentYellow",
+    "HueAdjustmentGreen",
+    "HueAdjustmentAqua",
+    "HueAdjustmentBlue",
+    "HueAdjustmentPurple",
+    "HueAdjustmentMagenta",
+    "LuminanceAdjustmentRed",
+    "LuminanceAdjustmentOrange",
+    "LuminanceAdjustmentYellow",
+    "LuminanceAdjustmentGreen",
+    "LuminanceAdjustmentAqua",
+    "LuminanceAdjustmentBlue",
+    "LuminanceAdjustmentPurple",
+    "LuminanceAdjustmentMagenta",
+    "GrayMixerRed",
+    "GrayMixerOrange",
+    "GrayMixerYellow",
+    "GrayMixerGreen",
+    "GrayMixerAqua",
+    "GrayMixerBlue",
+    "GrayMixerPurple",
+    "GrayMixerMagenta",
+    /* Split Toning */
+    "SplitToningShadowHue",
+    "SplitToningShadowSaturation",
+    "SplitToningHighlightHue",
+    "SplitToningHighlightSaturation",
+    "SplitToningBalance",
+    /* Detail */
+    "Sharpness",
+    "SharpenRadius",
+    "SharpenDetail",
+    "SharpenEdgeMasking",
+    "LuminanceSmoothing",
+    "LuminanceNoiseReductionDetail",
+    "LuminanceNoiseReductionContrast",
+    "ColorNoiseReduction",
+    "ColorNoiseReductionDetail",
+    "ColorNoiseReductionSmoothness",
+    /* Lens Corrections */
+    "LensProfileDistortionScale",
+    "LensProfileChromaticAberrationScale",
+    "LensProfileVignettingScale",
+    "DefringePurpleAmount",
+    "DefringePurpleHueLo",
+    "DefringePurpleHueHi",
+    "DefringeGreenAmount",
+    "DefringeGreenHueLo",
+    "DefringeGreenHueHi",
+    "LensManualDistortionAmount",
+    "PerspectiveVertical",
+    "PerspectiveHorizontal",
+    "PerspectiveRotate",
+    "PerspectiveScale",
+    "PerspectiveAspect",
+    "VignetteAmount",
+    "VignetteMidpoint",
+    /* Effects */
+    "Dehaze",
+    "PostCropVignetteAmount",
+    "PostCropVignetteMidpoint",
+    "PostCropVignetteFeather",
+    "PostCropVignetteRoundness",
+    "PostCropVignetteStyle",
+    "PostCropVignetteHighlightContrast",
+    "GrainAmount",
+    "GrainSize",
+    "GrainFrequency",
+    /* Calibration */
+    "ShadowTint",
+    "RedHue",
+    "RedSaturation",
+    "GreenHue",
+    "GreenSaturation",
+    "BlueHue",
+    "BlueSaturation",
+    /* Local Adjustments */
+    "local_Temperature",
+    "local_Tint",
+    "local_Exposure",
+    "local_Contrast",
+    "local_Highlights",
+    "local_Shadows",
+    "local_Whites2012",
+    "local_Blacks2012",
+    "local_Clarity",
+    "local_Dehaze",
+    "local_Saturation",
+    "local_Sharpness",
+    "local_LuminanceNoise",
+    "local_Moire",
+    "local_Defringe",
+    "local_ToningLuminance",
+    /* Crop */
+    "straightenAngle",
+    "CropAngle",
+    "CropBottom",
+    "CropLeft",
+    "CropRight",
+    "CropTop",
+};
+
+const LRCommandId LRCommandList::kUnmapped = 0;
+const LRCommandId LRCommandList::kPreviousProfile =
+  static_cast<LRCommandId>(LRStringList.size());
+const LRCommandId LRCommandList::kNextProfile =
+  static_cast<LRCommandId>(LRStringList.size() + 1);
+const LRCommandId LRCommandList::kNoCommand = 0xFFFF;
+const size_t LRCommandList::kMaxCommands = 2048;
+
+namespace {
+  // Perfect hash over a fixed set of names, so a name can be looked up from a
+  // char buffer without building a String. Keys are grouped into buckets by one
+  // hash, and each bucket gets a seed for a second hash that sends its keys to
+  // distinct slots (hash and displace). A lookup is two hashes and a memcmp.
+  class PerfectHash {
+  public:
+    void build(const std::unordered_map<String, LRCommandId>& keys) {
+      const auto key_count = std::max<size_t>(keys.size(), 1);
+      bucket_mask_ = static_cast<uint32>(nextPowerOfTwo(
+        static_cast<int>((key_count + 1) / 2)) - 1);
+      slot_mask_ = static_cast<uint32>(nextPowerOfTwo(
+        static_cast<int>(key_count * 2)) - 1);
+      seeds_.assign(bucket_mask_ + 1u, 0);
+      slots_.assign(slot_mask_ + 1u, Slot{});
 
-  // better to check for empty then length, as empty has a constant run time behavior.
-  if (indexMap.empty()) {
-    int idx = 0;
-    for (auto &str : LRStringList)
-      indexMap[str] = idx++;
+      std::vector<std::vector<Slot>> buckets(bucket_mask_ + 1u);
+      for (const auto& key : keys) {
+        Slot entry{key.first.toStdString(), key.second};
+        buckets[Hash_(0, entry.name.data(), entry.name.size()) & bucket_mask_]
+          .push_back(std::move(entry));
+      }
+      // place the largest buckets first, while the table is emptiest
+      std::vector<size_t> order(buckets.size());
+      for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+      std::sort(order.begin(), order.end(), [&buckets](size_t a, size_t b) {
+        return buckets[a].size() > buckets[b].size(); });
 
-    for (auto &str : NextPrevProfile)
-      indexMap[str] = idx++;
+      std::vector<uint32> placed;
+      for (const auto bucket : order) {
+        if (buckets[bucket].empty())
+          break;
+        for (uint32 seed = 1; seed != 0; ++seed) {
+          placed.clear();
+          for (const auto& entry : buckets[bucket]) {
+            const auto slot = Hash_(seed, entry.name.data(), entry.name.size()) &
+              slot_mask_;
+            if (slots_[slot].id != LRCommandList::kNoCommand ||
+              std::find(placed.begin(), placed.end(), slot) != placed.end())
+              break;
+            placed.push_back(slot);
+          }
+          if (placed.size() == buckets[bucket].size()) {
+            seeds_[bucket] = seed;
+            for (size_t i = 0; i < placed.size(); ++i)
+              slots_[placed[i]] = std::move(buckets[bucket][i]);
+            break;
+          }
+        }
+        jassert(seeds_[bucket] != 0); // ran out of seeds, duplicate key?
+      }
+    }
+
+    LRCommandId find(const char* name, size_t length) const noexcept {
+      if (slots_.empty())
+        return LRCommandList::kNoCommand;
+      const auto seed = seeds_[Hash_(0, name, length) & bucket_mask_];
+      const auto& slot = slots_[Hash_(seed, name, length) & slot_mask_];
+      if (slot.name.size() == length &&
+        std::memcmp(slot.name.data(), name, length) == 0)
+        return slot.id;
+      return LRCommandList::kNoCommand;
+    }
+
+  private:
+    struct Slot {
+      std::string name;
+      LRCommandId id{LRCommandList::kNoCommand};
+    };
+
+    // FNV-1a with the seed folded into the offset basis
+    static uint32 Hash_(uint32 seed, const char* name, size_t length) noexcept {
+      auto hash = 2166136261u ^ (seed * 0x9E3779B9u);
+      for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<uint8>(name[i]);
+        hash *= 16777619u;
+      }
+      return hash ^ (hash >> 15);
+    }
+
+    uint32 bucket_mask_{0};
+    uint32 slot_mask_{0};
+    std::vector<uint32> seeds_;
+    std::vector<Slot> slots_;
+  };
+
+  // Process-wide table of command strings. Strings are only ever appended, so
+  // an id, once handed out, can be turned back into its string without locking.
+  class CommandRegistry {
+  public:
+    CommandRegistry():
+      strings_{new String[LRCommandList::kMaxCommands]},
+      continuous_{new bool[LRCommandList::kMaxCommands]()} {
+      for (const auto& str : LRCommandList::LRStringList)
+        Add_(str, builtin_ids_);
+      for (const auto& str : LRCommandList::NextPrevProfile)
+        Add_(str, builtin_ids_);
+      builtin_hash_.build(builtin_ids_);
+      for (const auto& str : LRCommandList::DevelopParameters)
+        continuous_[builtin_ids_.at(str)] = true;
+    }
+
+    LRCommandId intern(const String& command) {
+      const auto id = find(command);
+      if (id != LRCommandList::kNoCommand)
+        return id;
+      std::lock_guard<decltype(mutex_)> lock(mutex_);
+      const auto found = extra_ids_.find(command);
+      if (found != extra_ids_.end())
+        return found->second;
+      if (count_.load() >= LRCommandList::kMaxCommands) {
+        // the profile is mapped as Unmapped and won't save this command again
+        Logger::writeToLog("MIDI2LR: command registry is full, " + command +
+          " is unmapped");
+        jassertfalse;
+        return LRCommandList::kUnmapped;
+      }
+      // the plugin sets any name it has no action for as a develop parameter,
+      // see Client.lua
+      continuous_[count_.load()] = !command.startsWith("Reset");
+      return Add_(command, extra_ids_);
+    }
+
+    LRCommandId find(const String& command) const {
+        // the built-in table never changes after construction
+      const auto builtin = builtin_ids_.find(command);
+      if (builtin != builtin_ids_.end())
+        return builtin->second;
+      std::lock_guard<decltype(mutex_)> lock(mutex_);
+      const auto found = extra_ids_.find(command);
+      return found != extra_ids_.end() ? found->second : LRCommandList::kNoCommand;
+    }
+
+    LRCommandId find(const char* command, size_t length) const {
+      const auto id = builtin_hash_.find(command, length);
+      if (id != LRCommandList::kNoCommand)
+        return id;
+      // only commands read from a profile land here, so only they pay for a
+      // String
+      if (size() == builtin_ids_.size())
+        return LRCommandList::kNoCommand;
+      return find(String::fromUTF8(command, static_cast<int>(length)));
+    }
+
+    const String& string(LRCommandId id) const noexcept {
+      jassert(id < count_.load(std::memory_order_acquire));
+      return strings_[id < count_.load(std::memory_order_acquire) ? id : 0];
+    }
+
+    size_t size() const noexcept {
+      return count_.load(std::memory_order_acquire);
+    }
+
+    bool continuous(LRCommandId id) const noexcept {
+      return id < count_.load(std::memory_order_acquire) && continuous_[id];
+    }
+
+  private:
+    LRCommandId Add_(const String& command,
+      std::unordered_map<String, LRCommandId>& ids) {
+      const auto id = static_cast<LRCommandId>(count_.load());
+      strings_[id] = command;
+      ids[command] = id;
+      count_.store(id + 1u, std::memory_order_release);
+      return id;
+    }
+
+    mutable std::mutex mutex_;
+    std::atomic<size_t> count_{0};
+    std::unique_ptr<String[]> strings_;
+    std::unique_ptr<bool[]> continuous_; // set before the id is published
+    std::unordered_map<String, LRCommandId> builtin_ids_;
+    std::unordered_map<String, LRCommandId> extra_ids_;
+    PerfectHash builtin_hash_;
+  };
+
+  CommandRegistry& Registry() {
+    static CommandRegistry registry;
+    return registry;
   }
+}
+
+LRCommandId LRCommandList::getCommandId(const String& command) {
+  return Registry().intern(command);
+}
+
+LRCommandId LRCommandList::findCommandId(const String& command) {
+  return Registry().find(command);
+}
+
+LRCommandId LRCommandList::findCommandId(const char* command, size_t length) {
+  return Registry().find(command, length);
+}
+
+const String& LRCommandList::getCommandString(LRCommandId id) noexcept {
+  return Registry().string(id);
+}
+
+size_t LRCommandList::getCommandCount() noexcept {
+  return Registry().size();
+}
 
-  return indexMap[command];
-}
\ No newline at end of file
+bool LRCommandList::isContinuous(LRCommandId id) noexcept {
+  return Registry().continuous(id);
+}
@@ -25,6 +25,9 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 #include <vector>
 #include "../JuceLibraryCode/JuceHeader.h"
 
+// dense identifier of a command string, see LRCommandList::getCommandId
+using LRCommandId = uint16;
+
 class LRCommandList {
 public:
     // Strings that LR uses
@@ -54,8 +57,40 @@ class LRCommandList {
   // MIDI2LR commands
   static const std::vector<String> NextPrevProfile;
 
-  // Map of command strings to indices
-  static int getIndexOfCommand(const String& command);
+  // the commands in LRStringList that the plugin sets as develop parameters
+  // from a value; all other built-in commands are one-shot actions. Mirrors
+  // the routing in Client.lua
+  static const std::vector<String> DevelopParameters;
+
+  // ids of the commands MIDI2LR checks for itself
+  static const LRCommandId kUnmapped;
+  static const LRCommandId kPreviousProfile;
+  static const LRCommandId kNextProfile;
+  // returned when a command or mapping doesn't exist
+  static const LRCommandId kNoCommand;
+  // upper bound on the number of ids handed out
+  static const size_t kMaxCommands;
+
+  // returns the id of a command, registering it if it isn't known yet. The
+  // built-in commands get the ids of their position in LRStringList followed
+  // by NextPrevProfile
+  static LRCommandId getCommandId(const String& command);
+
+  // returns the id of a command, or kNoCommand if it has never been registered
+  static LRCommandId findCommandId(const String& command);
+  // same, for a name in a UTF-8 buffer that isn't null terminated. Built-in
+  // commands are found without allocating
+  static LRCommandId findCommandId(const char* command, size_t length);
+
+  // returns the string of a registered command
+  static const String& getCommandString(LRCommandId id) noexcept;
+
+  // number of ids handed out so far
+  static size_t getCommandCount() noexcept;
+
+  // true if the command takes a continuous value, where only the newest one
+  // matters, false for a one-shot action
+  static bool isContinuous(LRCommandId id) noexcept;
 
 private:
   LRCommandList() noexcept;
@@ -89,8 +89,10 @@ LrTasks.startAsyncTask(
     --global variables
     MIDI2LR = {PARAM_OBSERVER = {}, SERVER = {}, CONTROL_MAX = 127 } --non-local but in MIDI2LR namespace
     --local variables
+    local AckParam            = nil -- parameter whose next value MIDI2LR asked to have acked
     local LastParam           = ''
-    local UpdateParamPickup, UpdateParamNoPickup, UpdateParam
+    local Subscribed          = ParamList.SendToMidi -- parameters MIDI2LR has mapped, all until it says
+    local UpdateParamPickup, UpdateParamNoPickup, UpdateParam, UpdateParamRelative
     --local constants--may edit these to change program behaviors
     local RECEIVE_PORT     = 58763
     local SEND_PORT        = 58764
@@ -399,7 +401,70 @@ LrTasks.startAsyncTask(
         Profiles.changeProfile(ParamList.ProfileMap[param])
       end
     end
-    UpdateParam = UpdateParamPickup --initial state
+    UpdateParam = UpdateParamNoPickup --initial state, MIDI2LR decides pickup before sending
+
+    --called within LrRecursionGuard for setting
+    --midi_delta is a signed change from an endless encoder, in midi units
+    function UpdateParamRelative(param, midi_delta)
+      local value
+      if LrApplicationView.getCurrentModuleName() ~= 'develop' then
+        LrApplicationView.switchToModule('develop')
+      end
+      local min,max = Limits.GetMinMax(param)
+      value = LrDevelopController.getValue(param) + midi_delta/MIDI2LR.CONTROL_MAX * (max-min)
+      if value > max then value = max end
+      if value < min then value = min end
+      MIDI2LR.PARAM_OBSERVER[param] = value
+      LrDevelopController.setValue(param, value)
+      LastParam = param
+      if ProgramPreferences.ClientShowBezelOnChange then
+        LrDialogs.showBezel(param..'  '..LrStringUtils.numberToStringWithSeparators(value,Ut.precision(value)))
+      end
+      if ParamList.ProfileMap[param] then
+        Profiles.changeProfile(ParamList.ProfileMap[param])
+      end
+    end
+    --MIDI2LR sends the comma separated parameters its profile maps, only those
+    --are observed and sent back. Kept in the order of ParamList.SendToMidi
+    SETTINGS.Subscribe = function(value)
+      local wanted = {}
+      for param in value:gmatch('[^,]+') do
+        wanted[param] = true
+      end
+      local list = {}
+      for _,param in ipairs(ParamList.SendToMidi) do
+        if wanted[param] then
+          list[#list+1] = param
+        end
+      end
+      Subscribed = list
+    end
+    --MIDI2LR samples one value per round trip, acking every value would double
+    --the traffic it coalesces away
+    SETTINGS.AckNext = function(value) AckParam = value end
+    local function Acknowledge(param)
+      if param == AckParam then
+        AckParam = nil
+        MIDI2LR.SERVER:send(string.format('Ack %s\n', param)) -- times LR's round trip
+      end
+    end
+    --answers MIDI2LR's snapshot request, sent when it (re)connects, with the
+    --value of every subscribed parameter in a single send; MIDI2LR passes on only values
+    --its controllers don't already show
+    SETTINGS.Snapshot = function()
+      if LrApplicationView.getCurrentModuleName() ~= 'develop' then return end -- observer catches up on entering develop
+      local lines = {}
+      for _,param in ipairs(Subscribed) do
+        local lrvalue = LrDevelopController.getValue(param)
+        if type(lrvalue) == 'number' then
+          lines[#lines+1] = string.format('%s %g\n', param, LRValueToMIDIValue(param))
+          MIDI2LR.PARAM_OBSERVER[param] = lrvalue
+        end
+      end
+      if #lines > 0 then
+        MIDI2LR.SERVER:send(table.concat(lines))
+      end
+    end
 
 
     LrFunctionContext.callWithContext( 
@@ -415,7 +480,7 @@ LrTasks.startAsyncTask(
         --call following within guard for reading
         local function AdjustmentChangeObserver(observer)
           if LrApplicationView.getCurrentModuleName() == 'develop' then
-            for _,param in ipairs(ParamList.SendToMidi) do
+            for _,param in ipairs(Subscribed) do
               local lrvalue = LrDevelopController.getValue(param)
               if observer[param] ~= lrvalue and type(lrvalue) == 'number' then
                 MIDI2LR.SERVER:send(string.format('%s %g\n', param, LRValueToMIDIValue(param)))
@@ -461,8 +526,12 @@ LrTasks.startAsyncTask(
                 if(tonumber(value) == BUTTON_ON) then Ut.execFOM(LrDevelopController.resetToDefault,param:sub(6)) end
               elseif(SETTINGS[param]) then -- do something requiring the transmitted value to be known
                 SETTINGS[param](value)
+              elseif(value:find('^[+-]')) then -- signed change from a relative encoder
+                guardsetting:performWithGuard(UpdateParamRelative,param,tonumber(value))
+                Acknowledge(param)
               else -- otherwise update a develop parameter
                 guardsetting:performWithGuard(UpdateParam,param,tonumber(value))
+                Acknowledge(param)
               end
             end
           end,
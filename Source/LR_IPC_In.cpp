@@ -20,139 +20,279 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "LR_IPC_In.h"
 #include <bitset>
+#include <cstring>
+#include <string>
+#include "LatencyStats.h"
+#include "LRCommands.h"
 
 constexpr auto kLrInPort = 58764;
+constexpr auto kNoValue = -1;
+constexpr auto kReadBufferSize = 4096;
+constexpr size_t kMaxLineLength = 1024;
+constexpr auto kReadyTimeout = 100; //ms
 
-LR_IPC_IN::LR_IPC_IN(): StreamingSocket{}, Thread{"LR_IPC_IN"} {}
+namespace {
+  // true if the unterminated name equals the literal
+  template<size_t N>
+  bool Matches(const char* name, size_t length, const char(&literal)[N]) noexcept {
+    return length == N - 1 && std::memcmp(name, literal, N - 1) == 0;
+  }
+
+  // parses a leading integer the way String::getIntValue does, ignoring
+  // whatever follows it (Lightroom may send fractional values)
+  int ParseInt(const char* begin, const char* end) noexcept {
+    while (begin < end && CharacterFunctions::isWhitespace(*begin))
+      ++begin;
+    auto negative = false;
+    if (begin < end && (*begin == '-' || *begin == '+'))
+      negative = (*begin++ == '-');
+    auto value = 0;
+    while (begin < end && *begin >= '0' && *begin <= '9')
+      value = value * 10 + (*begin++ - '0');
+    return negative ? -value : value;
+  }
+
+  // parses a value in the plugin's 0-127 scale, which Lua writes with %g, into
+  // 0-kMaxFeedbackValue in fixed point: 127 * 129 is 16383, so each step of the
+  // plugin's scale is 129 units. Out of range values are clamped
+  int ParseFeedback(const char* begin, const char* end) noexcept {
+    constexpr int64 kUnitsPerStep = kMaxFeedbackValue / 127;
+    constexpr int64 kMaxMantissa = 100000000000000; // %g only has 6 digits
+    while (begin < end && CharacterFunctions::isWhitespace(*begin))
+      ++begin;
+    auto negative = false;
+    if (begin < end && (*begin == '-' || *begin == '+'))
+      negative = (*begin++ == '-');
+    int64 mantissa = 0;
+    auto exponent = 0; // value is mantissa * 10^exponent
+    for (; begin < end && *begin >= '0' && *begin <= '9'; ++begin) {
+      if (mantissa < kMaxMantissa)
+        mantissa = mantissa * 10 + (*begin - '0');
+      else
+        ++exponent;
+    }
+    if (begin < end && *begin == '.') {
+      for (++begin; begin < end && *begin >= '0' && *begin <= '9'; ++begin) {
+        if (mantissa < kMaxMantissa) {
+          mantissa = mantissa * 10 + (*begin - '0');
+          --exponent;
+        }
+      }
+    }
+    if (begin < end && (*begin == 'e' || *begin == 'E'))
+      exponent += jlimit(-100, 100, ParseInt(begin + 1, end));
+    if (negative || mantissa == 0)
+      return 0;
+    auto scaled = mantissa * kUnitsPerStep;
+    for (; exponent > 0 && scaled <= kMaxFeedbackValue; --exponent)
+      scaled *= 10;
+    if (exponent > 0)
+      return kMaxFeedbackValue;
+    if (exponent < -18)
+      return 0;
+    int64 divisor = 1;
+    for (; exponent < 0; ++exponent)
+      divisor *= 10;
+    return static_cast<int>(jmin(static_cast<int64>(kMaxFeedbackValue),
+      (scaled + divisor / 2) / divisor));
+  }
+}
+
+LR_IPC_IN::LR_IPC_IN(): StreamingSocket{}, Thread{"LR_IPC_IN"},
+  parameter_map_(LRCommandList::kMaxCommands, kNoValue) {}
 
 LR_IPC_IN::~LR_IPC_IN() {
-  stopTimer();
+  PleaseStopThread();
   stopThread(1000);
-  close();
+  {
+    std::lock_guard<decltype(socket_mutex_)> lock(socket_mutex_);
+    close();
+  }
   command_map_.reset();
   profile_manager_.reset();
   midi_sender_.reset();
+  lr_ipc_out_.reset();
 }
 
 void LR_IPC_IN::Init(std::shared_ptr<CommandMap>& map_command,
   std::shared_ptr<ProfileManager>& profile_manager,
-  std::shared_ptr<MIDISender>& midi_sender) noexcept {
+  std::shared_ptr<MIDISender>& midi_sender,
+  std::shared_ptr<LR_IPC_OUT>& lr_ipc_out) noexcept {
   command_map_ = map_command;
   profile_manager_ = profile_manager;
   midi_sender_ = midi_sender;
-  //start the timer
-  startTimer(1000);
+  lr_ipc_out_ = lr_ipc_out;
+  //the thread connects, then reads
+  startThread();
 }
 
-void LR_IPC_IN::refreshMIDIOutput() {
+void LR_IPC_IN::refreshMIDIOutput(bool force_resync) {
+  // devices or mappings changed, so what each device shows is unknown
+  if (force_resync && midi_sender_)
+    midi_sender_->forceResync();
   if (command_map_) {
       // send associated CC messages to MIDI OUT devices
-    for (auto map_entry : parameter_map_) {
-      if ((command_map_->commandHasAssociatedMessage(map_entry.first)) &&
-        (midi_sender_)) {
-        const auto& msg = command_map_->getMessageForCommand(map_entry.first);
-        midi_sender_->sendCC(msg.channel, msg.controller, map_entry.second);
+    for (size_t command = 0; command < parameter_map_.size(); command++) {
+      MIDI_Message msg;
+      FEEDBACK_FORMAT format;
+      if ((parameter_map_[command] != kNoValue) && (midi_sender_) &&
+        command_map_->findFeedbackForCommand(static_cast<LRCommandId>(command),
+        msg, format)) {
+        midi_sender_->sendCC(msg, parameter_map_[command], format);
       }
     }
   }
 }
 
+uint32 LR_IPC_IN::getOversizeLineCount() const noexcept {
+  return oversize_lines_.load(std::memory_order_relaxed);
+}
+
+void LR_IPC_IN::SetState_(CONNECTION_STATE state) {
+  if (lr_ipc_out_)
+    lr_ipc_out_->setInputState(state);
+}
+
 void LR_IPC_IN::PleaseStopThread() {
   signalThreadShouldExit();
   notify();
 }
 
 void LR_IPC_IN::run() {
+  std::vector<char> read_buffer(kReadBufferSize);
+  std::string pending_line; // partial line carried over between reads
+  pending_line.reserve(kMaxLineLength);
+  auto discarding = false; // skipping the rest of an oversize line
   while (!threadShouldExit()) {
-    //if not connected, executes a wait 333 then goes back to while
-    //if connected, tries to read a line, checks thread status and connection
-    //status before each read attempt
-    //doesn't terminate thread if disconnected, as currently don't have graceful
-    //way to restart thread
+    //if not connected, tries to connect, waiting longer after each failure.
+    //Connecting here keeps the 100 ms connect timeout off the message thread
     if (!isConnected()) {
-      wait(333);
-    } //end if (is not connected)
-    else {
-      constexpr auto kBufferSize = 256;
-      char line[kBufferSize + 1] = {'\0'};//plus one for \0 at end
-      auto size_read = 0;
-      auto can_read_line = true;
-      // parse input until we have a line, then process that line, quit if
-      // connection lost
-      while (!juce::String(line).endsWithChar('\n') && isConnected()) {
-        if (threadShouldExit())
-          goto threadExit;//break out of nested whiles
-        auto wait_status = waitUntilReady(true, 0);
-        switch (wait_status) {
-          case -1:
-            can_read_line = false;
-            goto dumpLine; //read line failed, break out of switch and while         
-          case 0:
-            wait(100);
-            break; //try again to read until char shows up
-          case 1:
-            if (size_read == kBufferSize)
-              throw std::out_of_range("Buffer overflow in LR_IPC_IN");
-            size_read += read(line + size_read, 1, false);
-            break;
-          default:
-            throw std::invalid_argument("waitUntilReady returned unexpected value");
+      pending_line.clear();
+      discarding = false;
+      SetState_(CONNECTION_STATE::CONNECTING);
+      bool connected;
+      {
+        std::lock_guard<decltype(socket_mutex_)> lock(socket_mutex_);
+        connected = connect("127.0.0.1", kLrInPort, 100);
+      }
+      if (connected) {
+        backoff_.reset();
+        SetState_(CONNECTION_STATE::CONNECTED);
+        // the plugin answers with every mapped parameter's value in one block, only
+        // the ones the devices don't already show go out to them
+        if (lr_ipc_out_)
+          lr_ipc_out_->requestSnapshot();
+      }
+      else {
+        SetState_(CONNECTION_STATE::DISCONNECTED);
+        wait(backoff_.nextDelay()); // PleaseStopThread notifies
+      }
+      continue;
+    }
+    // block until data arrives, the timeout only bounds how long it takes to
+    // notice threadShouldExit
+    const auto wait_status = waitUntilReady(true, kReadyTimeout);
+    if (wait_status == 0)
+      continue;
+    const auto size_read = (wait_status < 0) ? -1 :
+      read(read_buffer.data(), kReadBufferSize, false);
+    if (size_read <= 0) {
+      // ready but nothing to read means Lightroom closed its end, the next
+      // pass reconnects
+      std::lock_guard<decltype(socket_mutex_)> lock(socket_mutex_);
+      close();
+      SetState_(CONNECTION_STATE::DISCONNECTED);
+      continue;
+    }
+    // process every complete line in the block, keep the tail for next read
+    const auto read_time = LatencyStats::now();
+    const char* line_start = read_buffer.data();
+    const char* const read_end = line_start + size_read;
+    while (line_start < read_end) {
+      const auto newline = static_cast<const char*>(
+        std::memchr(line_start, '\n', static_cast<size_t>(read_end - line_start)));
+      const auto segment_end = newline ? newline : read_end;
+      if (!discarding) {
+        if (pending_line.size() + static_cast<size_t>(segment_end - line_start) >
+          kMaxLineLength) {
+          // not a message we understand, drop it through the next newline
+          pending_line.clear();
+          discarding = true;
+          ++oversize_lines_;
         }
-      } // end while !\n and is connected
-
-      // if lose connection, line may not be terminated
-      if (can_read_line && juce::String(line).endsWithChar('\n')) {
-        juce::String param{line};
-        processLine(param);
+        else if (newline == nullptr || !pending_line.empty())
+          pending_line.append(line_start, segment_end);
       }
-    dumpLine: /* empty statement */;
-    } //end else (is connected)
+      if (newline == nullptr)
+        break;
+      if (!discarding) {
+        // lines that arrived whole are parsed straight from the read buffer
+        if (pending_line.empty())
+          processLine(line_start, static_cast<size_t>(newline - line_start),
+            read_time);
+        else
+          processLine(pending_line.data(), pending_line.size(), read_time);
+      }
+      pending_line.clear();
+      discarding = false;
+      line_start = newline + 1;
+    }
   } //while not threadshouldexit
-threadExit: /* empty statement */;
-  std::lock_guard< decltype(timer_mutex_) > lock(timer_mutex_);
-  stopTimer();
-  //thread_started_ = false; //don't change flag while depending upon it
 }
 
-void LR_IPC_IN::timerCallback() {
-  std::lock_guard< decltype(timer_mutex_) > lock(timer_mutex_);
-  if (!isConnected()) {
-    if (connect("127.0.0.1", kLrInPort, 100))
-      if (!thread_started_) {
-        startThread(); //avoid starting thread during shutdown
-        thread_started_ = true;
-      }
-  }
-}
-void LR_IPC_IN::processLine(const juce::String& line) {
-    // process input into [parameter] [Value]
-  const auto trimmed_line = line.trim();
-  const auto command = trimmed_line.upToFirstOccurrenceOf(" ", false, false);
-  const auto value_string = trimmed_line.fromFirstOccurrenceOf(" ", false, false);
-  const auto value = value_string.getIntValue();
+void LR_IPC_IN::processLine(const char* line, size_t length, double timestamp) {
+    // process input into [parameter] [Value], working in place on the buffer
+  auto begin = line;
+  auto end = line + length;
+  while (begin < end && CharacterFunctions::isWhitespace(*begin))
+    ++begin;
+  while (end > begin && CharacterFunctions::isWhitespace(*(end - 1)))
+    --end;
+  const auto space = static_cast<const char*>(
+    std::memchr(begin, ' ', static_cast<size_t>(end - begin)));
+  const auto command_end = space ? space : end;
+  const auto command_length = static_cast<size_t>(command_end - begin);
+  const auto value_begin = space ? space + 1 : end;
 
   if (command_map_) {
-    if (command == juce::String{"SwitchProfile"}) {
+    if (Matches(begin, command_length, "SwitchProfile")) {
       if (profile_manager_) {
-        profile_manager_->switchToProfile(value_string);
+        profile_manager_->switchToProfile(String::fromUTF8(value_begin,
+          static_cast<int>(end - value_begin)));
       }
     }
-    else if (command == juce::String{"SendKey"}) {
-      std::bitset<3> modifiers{static_cast<decltype(modifiers)>(value)};
+    else if (Matches(begin, command_length, "SendKey")) {
+      std::bitset<3> modifiers{static_cast<decltype(modifiers)>(
+        ParseInt(value_begin, end))};
+      const auto value_string = String::fromUTF8(value_begin,
+        static_cast<int>(end - value_begin));
       std::string str{value_string.trimCharactersAtStart("0123456789 ").toStdString()};
       send_keys_.SendKeyDownUp(str, modifiers[0], modifiers[1], modifiers[2]);
     }
+    else if (Matches(begin, command_length, "Ack")) {
+      if (lr_ipc_out_) {
+        lr_ipc_out_->acknowledged(LRCommandList::findCommandId(value_begin,
+          static_cast<size_t>(end - value_begin)), timestamp);
+      }
+    }
     else {
-        // store updates in map
-      parameter_map_[command] = value;
+      const auto id = LRCommandList::findCommandId(begin, command_length);
+      if (id == LRCommandList::kNoCommand)
+        return; //not a command any profile can map
+      MIDI_Message msg;
+      FEEDBACK_FORMAT format;
+      if (!command_map_->findFeedbackForCommand(id, msg, format))
+        return; //not subscribed, e.g. sent before the plugin got the subscription
 
-      // send associated CC messages to MIDI OUT devices
-      if (command_map_->commandHasAssociatedMessage(command)) {
-        const auto& msg = command_map_->getMessageForCommand(command);
+        // store updates in map, at the full resolution the plugin sent
+      const auto value = ParseFeedback(value_begin, end);
+      parameter_map_[id] = value;
+      if (lr_ipc_out_)
+        lr_ipc_out_->parameterChanged(id, value);
 
-        if (midi_sender_) {
-          midi_sender_->sendCC(msg.channel, msg.controller, value);
-        }
+      // send associated CC messages to MIDI OUT devices
+      if (midi_sender_) {
+        midi_sender_->sendCC(msg, value, format, timestamp);
       }
     }
   }
@@ -21,41 +21,54 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 */
 #ifndef LR_IPC_IN_H_INCLUDED
 #define LR_IPC_IN_H_INCLUDED
-#include <unordered_map>
+#include <atomic>
+#include <vector>
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "CommandMap.h"
+#include "LR_IPC_OUT.h"
 #include "MIDISender.h"
 #include "ProfileManager.h"
+#include "ReconnectBackoff.h"
 #include "SendKeys.h"
 
 class LR_IPC_IN: private StreamingSocket,
-  private Timer,
   private Thread {
 public:
   LR_IPC_IN();
   virtual ~LR_IPC_IN();
   void Init(std::shared_ptr<CommandMap>& mapCommand,
     std::shared_ptr<ProfileManager>& profileManager,
-    std::shared_ptr<MIDISender>& midiSender) noexcept;
-  // re-enumerates MIDI OUT devices
-  void refreshMIDIOutput();
+    std::shared_ptr<MIDISender>& midiSender,
+    std::shared_ptr<LR_IPC_OUT>& lrIpcOut) noexcept;
+  // resends every known parameter value to the MIDI OUT devices. Without
+  // force_resync only values a device isn't known to show go out, e.g. to a
+  // newly attached device
+  void refreshMIDIOutput(bool force_resync = true);
+  // number of incoming lines dropped for exceeding the maximum line length
+  uint32 getOversizeLineCount() const noexcept;
   //signal exit to thread
   void PleaseStopThread(void);
 private:
-  // Thread interface
+  // passes the socket's state to LR_IPC_OUT, whose connection listeners are
+  // told about both sockets
+  void SetState_(CONNECTION_STATE state);
+  // Thread interface, reads from the plugin and reconnects when it goes away
   virtual void run() override;
-  // Timer callback
-  virtual void timerCallback() override;
-  // process a line received from the socket
-  void processLine(const String& line);
+  // process a line received from the socket, without the newline. timestamp
+  // is when it was read, see LatencyStats
+  void processLine(const char* line, size_t length, double timestamp);
 
-  bool thread_started_{false};
-  mutable std::mutex timer_mutex_;
+  mutable std::mutex socket_mutex_;
+  ReconnectBackoff backoff_; // reader thread only
   SendKeys send_keys_;
   std::shared_ptr<CommandMap> command_map_{nullptr};
   std::shared_ptr<MIDISender> midi_sender_{nullptr};
+  std::shared_ptr<LR_IPC_OUT> lr_ipc_out_{nullptr};
   std::shared_ptr<ProfileManager> profile_manager_{nullptr};
-  std::unordered_map<String, int> parameter_map_;
+  // last value received for each command id, 0-kMaxFeedbackValue, -1 if none
+  // yet
+  std::vector<int> parameter_map_;
+  std::atomic<uint32> oversize_lines_{0};
 };
 
 #endif  // LR_IPC_IN_H_INCLUDED
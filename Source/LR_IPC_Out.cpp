@@ -19,20 +19,34 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
   ==============================================================================
 */
 #include "LR_IPC_OUT.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 #include "CommandMap.h"
+#include "LatencyStats.h"
 #include "LRCommands.h"
 
 constexpr auto kLrOutPort = 58763;
+constexpr auto kMaxMIDI = 127;
+constexpr size_t kBufferSize = 64 * 1024; // reserved for the queued commands
+// most one-shot commands held for the plugin while it is away, in bytes
+constexpr size_t kMaxHeldBytes = 16 * 1024;
+constexpr auto kStopTimeout = 1000; // milliseconds
+// quiet time after a map edit before the subscription is checked, so learning
+// or editing several controls resubscribes once
+constexpr auto kSubscriptionDelay = 100; // milliseconds
 
-LR_IPC_OUT::LR_IPC_OUT(): InterprocessConnection() {}
+LR_IPC_OUT::LR_IPC_OUT(): InterprocessConnection(), Thread{"LR_IPC_OUT"} {}
 
 LR_IPC_OUT::~LR_IPC_OUT() {
+  cancelPendingUpdate();
+  PleaseStopThread();
   {
-    std::lock_guard<decltype(timer_mutex_)> lock(timer_mutex_);
-    timer_off_ = true;
-    stopTimer();
+    std::lock_guard<decltype(socket_mutex_)> lock(socket_mutex_);
     disconnect();
   }
+  if (command_map_)
+    command_map_->UnregisterObserver(this);
   command_map_.reset();
 }
 
@@ -40,13 +54,18 @@ void LR_IPC_OUT::Init(std::shared_ptr<CommandMap>& command_map,
   std::shared_ptr<MIDIProcessor>& midi_processor) {
     //copy the pointer
   command_map_ = command_map;
+  if (command_map_)
+    command_map_->RegisterObserver(this);
 
   if (midi_processor) {
-    midi_processor->addMIDICommandListener(this);
+    midi_processor->addMIDICommandListener(this,
+      ActionKindMask(ACTION_KIND::SEND_TO_LR));
   }
 
-  //start the timer
-  startTimer(1000);
+  command_.reserve(kBufferSize);
+  drained_.reserve(LRCommandList::kMaxCommands);
+  //the writer thread also connects
+  startThread();
 }
 
 void LR_IPC_OUT::addListener(LRConnectionListener *listener) {
@@ -54,53 +73,141 @@ void LR_IPC_OUT::addListener(LRConnectionListener *listener) {
 }
 
 void LR_IPC_OUT::sendCommand(const String &command) {
+  const auto* text = command.toRawUTF8();
+  std::lock_guard<decltype(command_mutex_)> lock(command_mutex_);
+  command_ += text;
+    // one untraced timestamp per line, see TrimHeld_
+  command_timestamps_.insert(command_timestamps_.end(),
+    static_cast<size_t>(std::count(text, text + std::strlen(text), '\n')), 0.0);
+  TrimHeld_();
+  wake_.notify_one();
+}
+
+void LR_IPC_OUT::requestSnapshot() {
+    // the writer builds the request, so a burst of map changes sends one
+  std::lock_guard<decltype(command_mutex_)> lock(command_mutex_);
+  subscription_pending_ = true;
+  wake_.notify_one();
+}
+
+void LR_IPC_OUT::parameterChanged(LRCommandId command, int value) {
+  takeover_.setParameterValue(command, value);
+}
+
+void LR_IPC_OUT::acknowledged(LRCommandId command, double time) {
+  rate_.acknowledged(command, time);
+}
+
+double LR_IPC_OUT::getRoundTrip() const {
+  return rate_.getRoundTrip();
+}
+
+void LR_IPC_OUT::setPickupEnabled(bool enabled) noexcept {
+  takeover_.setPickupEnabled(enabled);
+}
+
+void LR_IPC_OUT::setCoalesceWindow(int milliseconds) noexcept {
+  coalesce_window_ = jmax(0, milliseconds);
+}
+
+void LR_IPC_OUT::PleaseStopThread(void) {
+  signalThreadShouldExit();
   {
     std::lock_guard<decltype(command_mutex_)> lock(command_mutex_);
-    command_ += command;
+    wake_.notify_one();
   }
-  triggerAsyncUpdate();
+  stopThread(kStopTimeout);
 }
 
-void LR_IPC_OUT::handleMidiCC(int midi_channel, int controller, int value) {
-  MIDI_Message message{midi_channel, controller, true};
+void LR_IPC_OUT::setInputState(CONNECTION_STATE state) {
+  if (input_state_.exchange(state) != state)
+    triggerAsyncUpdate();
+}
 
-  if (command_map_) {
-    if (!command_map_->messageExistsInMap(message) ||
-      command_map_->getCommandforMessage(message) == "Unmapped" ||
-      find(LRCommandList::NextPrevProfile.begin(),
-      LRCommandList::NextPrevProfile.end(),
-      command_map_->getCommandforMessage(message)) != LRCommandList::NextPrevProfile.end())
-      return;
+CONNECTION_STATE LR_IPC_OUT::getConnectionState() const noexcept {
+  const auto connected = (state_.load() == CONNECTION_STATE::CONNECTED) +
+    (input_state_.load() == CONNECTION_STATE::CONNECTED);
+  return connected == 2 ? CONNECTION_STATE::CONNECTED : connected == 1 ?
+    CONNECTION_STATE::CONNECTING : CONNECTION_STATE::DISCONNECTED;
+}
 
-    auto command_to_send_ = command_map_->getCommandforMessage(message);
-    auto value_to_send_ = value;
-    {
-      std::lock_guard<decltype(command_mutex_)> lock(command_mutex_);
-      command_ += command_to_send_ + String::formatted(" %d\n", value_to_send_);
-    }
+void LR_IPC_OUT::SetState_(CONNECTION_STATE state) {
+  if (state_.exchange(state) != state)
     triggerAsyncUpdate();
-  }
 }
 
-void LR_IPC_OUT::handleMidiNote(int midi_channel, int note) {
-  MIDI_Message message{midi_channel, note, false};
+uint32 LR_IPC_OUT::getDroppedCommandCount() const noexcept {
+  return dropped_commands_.load();
+}
 
-  if (command_map_) {
-    if (!command_map_->messageExistsInMap(message) ||
-      command_map_->getCommandforMessage(message) == "Unmapped" ||
-      find(LRCommandList::NextPrevProfile.begin(),
-      LRCommandList::NextPrevProfile.end(),
-      command_map_->getCommandforMessage(message)) != LRCommandList::NextPrevProfile.end())
+void LR_IPC_OUT::handleMidiCC(const CommandMapping& mapping,
+  const MIDI_Message& /*message*/, int value, int max_value,
+  double timestamp) {
+    // MIDIProcessor only calls this for ACTION_KIND::SEND_TO_LR
+    // The plugin works in 0-127, a 14-bit value keeps its resolution as a
+    // fraction
+  const auto scale = max_value == kMaxMIDI ? 1.0 :
+    static_cast<double>(kMaxMIDI) / max_value;
+  const auto relative = mapping.mode != CC_MODE::ABS;
+  auto scaled = relative ?
+    RelativeDelta(mapping.mode, value, max_value) * scale : value * scale;
+  if (!LRCommandList::isContinuous(mapping.command)) {
+    // a CC used as a button: every press counts and goes out with the notes
+    std::lock_guard<decltype(command_mutex_)> lock(command_mutex_);
+    CCCoalescer::appendLine(command_, mapping.command, scaled, relative);
+    command_timestamps_.push_back(timestamp);
+    TrimHeld_();
+    wake_.notify_one();
+    return;
+  }
+  if (!relative) {
+      // pickup and scaling happen here, so a value the parameter wouldn't take
+      // never reaches the plugin
+    const auto taken = takeover_.process(mapping.command, mapping.takeover,
+      (value * kMaxFeedbackValue + max_value / 2) / max_value);
+    if (taken < 0)
       return;
-
-    auto command_to_send_ = command_map_->getCommandforMessage(message);
-    auto value_to_send_ = 127;
-    {
-      std::lock_guard<decltype(command_mutex_)> lock(command_mutex_);
-      command_ += command_to_send_ + String::formatted(" %d\n", value_to_send_);
-    }
-    triggerAsyncUpdate();
+    scaled = static_cast<double>(taken) * kMaxMIDI / kMaxFeedbackValue;
   }
+    // only the newest value per parameter is kept until the next flush, steps
+    // of relative controllers are summed
+  if (relative)
+    coalescer_.addDelta(mapping.command, scaled, timestamp);
+  else
+    coalescer_.add(mapping.command, scaled, timestamp);
+  std::lock_guard<decltype(command_mutex_)> lock(command_mutex_);
+  cc_pending_ = true;
+  wake_.notify_one();
+}
+
+void LR_IPC_OUT::handleMidiNote(const CommandMapping& mapping,
+  const MIDI_Message& /*message*/, double timestamp) {
+    // MIDIProcessor only calls this for ACTION_KIND::SEND_TO_LR
+  std::lock_guard<decltype(command_mutex_)> lock(command_mutex_);
+  command_ += LRCommandList::getCommandString(mapping.command).toRawUTF8();
+  command_ += " 127\n";
+  command_timestamps_.push_back(timestamp);
+  TrimHeld_();
+  wake_.notify_one();
+}
+
+void LR_IPC_OUT::Changed(Subject * /*changed*/) {
+    // a profile was loaded or a mapping edited; newly mapped parameters also
+    // need their values for the controllers to show
+  std::lock_guard<decltype(command_mutex_)> lock(command_mutex_);
+  map_changed_ = true;
+  map_changed_at_ = std::chrono::steady_clock::now();
+  wake_.notify_one();
+}
+
+void LR_IPC_OUT::handleAsyncUpdate() {
+    // a burst of changes is told once, with the state they ended in
+  const auto state = getConnectionState();
+  if (state == notified_state_)
+    return;
+  notified_state_ = state;
+  for (auto listener : listeners_)
+    listener->connectionStateChanged(state);
 }
 
 void LR_IPC_OUT::connectionMade() {
@@ -109,26 +216,214 @@ void LR_IPC_OUT::connectionMade() {
 }
 
 void LR_IPC_OUT::connectionLost() {
+  {
+    // wake the writer to start reconnecting, unless it already has
+    std::lock_guard<decltype(command_mutex_)> lock(command_mutex_);
+    if (!isConnected())
+      SetState_(CONNECTION_STATE::DISCONNECTED);
+    wake_.notify_one();
+  }
   for (auto listener : listeners_)
     listener->disconnected();
 }
 
 void LR_IPC_OUT::messageReceived(const MemoryBlock& /*msg*/) {}
 
-void LR_IPC_OUT::handleAsyncUpdate() {
-  String command_copy;
+void LR_IPC_OUT::run() {
+  std::string batch;
+  batch.reserve(kBufferSize);
+  std::vector<double> timestamps;
+  auto last_flush = std::chrono::steady_clock::now();
+  while (!threadShouldExit()) {
+    if (state_ != CONNECTION_STATE::CONNECTED) {
+      Reconnect_();
+      continue;
+    }
+    auto drain_cc = false;
+    size_t command_bytes;
+    size_t command_lines;
+    {
+      std::unique_lock<decltype(command_mutex_)> lock(command_mutex_);
+      const auto ready = [this] {
+        return threadShouldExit() || state_ != CONNECTION_STATE::CONNECTED ||
+          cc_pending_ || subscription_pending_ || !command_.empty();
+      };
+      if (map_changed_)
+        wake_.wait_until(lock, map_changed_at_ +
+          std::chrono::milliseconds(kSubscriptionDelay), ready);
+      else
+        wake_.wait(lock, ready);
+      if (threadShouldExit() || state_ != CONNECTION_STATE::CONNECTED)
+        continue;
+      const auto resubscribe = map_changed_ && std::chrono::steady_clock::now() >=
+        map_changed_at_ + std::chrono::milliseconds(kSubscriptionDelay);
+      if (!ready() && !resubscribe)
+        continue; // the map changed again meanwhile
+      // button/note commands go out at once; CC values wait until the window
+      // has passed since the last flush
+      if (cc_pending_) {
+        const auto due = last_flush +
+          std::chrono::milliseconds(rate_.window(coalesce_window_.load(),
+          LatencyStats::now()));
+        if (command_.empty()) {
+          wake_.wait_until(lock, due, [this] {
+            return threadShouldExit() || !command_.empty();
+          });
+        }
+        drain_cc = std::chrono::steady_clock::now() >= due;
+        if (drain_cc)
+          cc_pending_ = false;
+      }
+      batch.swap(command_); // both keep their capacity
+      timestamps.swap(command_timestamps_);
+      command_bytes = batch.size();
+      command_lines = timestamps.size();
+      if (subscription_pending_ || resubscribe) {
+        AppendSubscription_(batch, timestamps, subscription_pending_);
+        subscription_pending_ = false;
+        map_changed_ = false;
+      }
+    }
+    const auto written = Write_(batch, timestamps, command_bytes, command_lines,
+      drain_cc);
+    if (drain_cc)
+      last_flush = std::chrono::steady_clock::now();
+    batch.clear();
+    timestamps.clear();
+    if (!written)
+      wait(1); // even with no window, don't spin on a full socket
+  }
+}
+
+bool LR_IPC_OUT::Write_(std::string& batch, std::vector<double>& timestamps,
+  size_t command_bytes, size_t command_lines, bool drain_cc) {
+  std::lock_guard<decltype(socket_mutex_)> lock(socket_mutex_);
+  const auto connected = isConnected();
+  const auto subscription = batch.size() > command_bytes;
+  auto socket_ready = true;
+  auto sampled = false;
+  if (drain_cc) {
+    if (connected && getSocket()->waitUntilReady(false, 0) == 1) {
+      const auto drain_start = batch.size();
+      const auto drain_line = timestamps.size();
+      coalescer_.drainTo(batch, timestamps, drained_);
+      if (!drained_.empty() && rate_.wantsSample(LatencyStats::now())) {
+          // the plugin acks only the first value, one sample per round trip
+        std::string request{"AckNext "};
+        request += LRCommandList::getCommandString(drained_.front()).toRawUTF8();
+        request += '\n';
+        batch.insert(drain_start, request);
+        timestamps.insert(timestamps.begin() +
+          static_cast<std::ptrdiff_t>(drain_line), 0.0);
+        sampled = true;
+      }
+    }
+    else {
+      // socket is backed up or gone, keep coalescing
+      std::lock_guard<decltype(command_mutex_)> command_lock(command_mutex_);
+      cc_pending_ = true;
+      socket_ready = !connected;
+    }
+  }
+  // one write for everything queued since the last pass
+  const auto write_start = LatencyStats::now();
+  if (!connected || (!batch.empty() &&
+    getSocket()->write(batch.data(), static_cast<int>(batch.size())) < 0)) {
+    // the plugin went away. Only the one-shot commands are held for when it
+    // is back: the CC values go back to the coalescer, where newer ones
+    // replace them, and the subscription is built afresh
+    std::lock_guard<decltype(command_mutex_)> command_lock(command_mutex_);
+    command_.insert(0, batch, 0, command_bytes);
+    command_timestamps_.insert(command_timestamps_.begin(), timestamps.begin(),
+      timestamps.begin() + static_cast<std::ptrdiff_t>(command_lines));
+    if (!drained_.empty()) {
+      coalescer_.restoreDrained();
+      cc_pending_ = true;
+    }
+    if (subscription)
+      subscription_pending_ = true;
+    SetState_(CONNECTION_STATE::DISCONNECTED);
+    TrimHeld_();
+    drained_.clear();
+    return true;
+  }
+  if (!batch.empty()) {
+    LatencyStats::recordSince(LATENCY_STAGE::SOCKET_WRITE, write_start);
+    for (auto timestamp : timestamps)
+      LatencyStats::recordSince(LATENCY_STAGE::TO_LR, timestamp);
+  }
+  if (sampled)
+    rate_.sent(drained_.front(), LatencyStats::now());
+  drained_.clear();
+  return socket_ready;
+}
+
+void LR_IPC_OUT::AppendSubscription_(std::string& batch,
+  std::vector<double>& timestamps, bool force) {
+    // the plugin only observes the develop parameters, so only those are named
+  std::string subscription{"Subscribe "};
+  auto first = true;
+  if (command_map_) {
+    const auto count = LRCommandList::getCommandCount();
+    for (size_t command = 0; command < count; ++command) {
+      const auto id = static_cast<LRCommandId>(command);
+      if (LRCommandList::isContinuous(id) &&
+        command_map_->commandHasAssociatedMessage(id)) {
+        if (!first)
+          subscription += ',';
+        subscription += LRCommandList::getCommandString(id).toRawUTF8();
+        first = false;
+      }
+    }
+  }
+  if (!force && subscription == subscribed_)
+    return; // e.g. only unmapped rows were learned
+  subscribed_ = subscription;
+  batch += subscription;
+  batch += "\nSnapshot 1\n";
+  timestamps.insert(timestamps.end(), 2, 0.0);
+}
+
+void LR_IPC_OUT::Reconnect_() {
+  // what was queued meanwhile stays queued: one-shot commands up to
+  // kMaxHeldBytes, then the newest value of each parameter
+  SetState_(CONNECTION_STATE::CONNECTING);
+  bool connected;
   {
-    std::lock_guard<decltype(command_mutex_)> lock(command_mutex_);
-    command_copy = std::move(command_); //JUCE::String swaps in this case
+    std::lock_guard<decltype(socket_mutex_)> lock(socket_mutex_);
+    connected = connectToSocket("127.0.0.1", kLrOutPort, 100);
   }
-    //check if there is a connection
-  if (isConnected()) {
-    getSocket()->write(command_copy.getCharPointer(), command_copy.length());
+  if (connected) {
+    backoff_.reset();
+    subscribed_.clear(); // a restarted plugin has no subscription
+    rate_.reset(); // acks of what went before won't come
+    std::lock_guard<decltype(command_mutex_)> lock(command_mutex_);
+      // the time spent disconnected isn't latency
+    std::fill(command_timestamps_.begin(), command_timestamps_.end(), 0.0);
+    SetState_(CONNECTION_STATE::CONNECTED);
+    return;
   }
+  SetState_(CONNECTION_STATE::DISCONNECTED);
+  std::unique_lock<decltype(command_mutex_)> lock(command_mutex_);
+  wake_.wait_for(lock, std::chrono::milliseconds(backoff_.nextDelay()),
+    [this] {return threadShouldExit();});
 }
 
-void LR_IPC_OUT::timerCallback() {
-  std::lock_guard<decltype(timer_mutex_)> lock(timer_mutex_);
-  if (!isConnected() && !timer_off_)
-    connectToSocket("127.0.0.1", kLrOutPort, 100);
+void LR_IPC_OUT::TrimHeld_() {
+  if (state_ == CONNECTION_STATE::CONNECTED || command_.size() <= kMaxHeldBytes)
+    return;
+  // drop the oldest whole lines
+  size_t erase_end = 0;
+  size_t lines = 0;
+  while (command_.size() - erase_end > kMaxHeldBytes) {
+    const auto newline = command_.find('\n', erase_end);
+    if (newline == std::string::npos)
+      break;
+    erase_end = newline + 1;
+    ++lines;
+  }
+  command_.erase(0, erase_end);
+  command_timestamps_.erase(command_timestamps_.begin(), command_timestamps_.begin() +
+    static_cast<std::ptrdiff_t>(std::min(lines, command_timestamps_.size())));
+  dropped_commands_ += static_cast<uint32>(lines);
 }
@@ -22,10 +22,20 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef LR_IPC_OUT_H_INCLUDED
 #define LR_IPC_OUT_H_INCLUDED
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
+#include <string>
+#include <vector>
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "CCCoalescer.h"
 #include "CommandMap.h"
 #include "MIDIProcessor.h"
+#include "Pattern/Observer.h"
+#include "ReconnectBackoff.h"
+#include "SendRateControl.h"
+#include "Takeover.h"
 
 class LRConnectionListener {
 public:
@@ -35,6 +45,9 @@ class LRConnectionListener {
   // sent if disconnected from the LR plugin
   virtual void disconnected() = 0;
 
+  // sent on the message thread when LR_IPC_OUT::getConnectionState changes
+  virtual void connectionStateChanged(CONNECTION_STATE /*state*/) {}
+
   virtual ~LRConnectionListener() {};
 ///< .
 };
@@ -42,7 +55,8 @@ class LRConnectionListener {
 class LR_IPC_OUT: private InterprocessConnection,
   public MIDICommandListener,
   private AsyncUpdater,
-  private Timer {
+  private Observer,
+  private Thread {
 public:
   LR_IPC_OUT();
   virtual ~LR_IPC_OUT();
@@ -55,27 +69,116 @@ class LR_IPC_OUT: private InterprocessConnection,
   // sends a command to the plugin
   void sendCommand(const String& command);
 
+  // tells the plugin which parameters are mapped and asks for their current
+  // values, which it sends back to LR_IPC_IN in one block. Held until
+  // connected
+  void requestSnapshot();
+
+  // the plugin sent a parameter's value, 0-kMaxFeedbackValue, which absolute
+  // controllers are compared with before their values are sent
+  void parameterChanged(LRCommandId command, int value);
+
+  // the plugin applied the value sampled for the command, read at time. Times
+  // Lightroom's round trip, see SendRateControl
+  void acknowledged(LRCommandId command, double time);
+
+  // smoothed round trip through Lightroom in milliseconds, 0 until the first
+  // ack
+  double getRoundTrip() const;
+
+  // turns pickup on or off for mappings that follow the pickup setting
+  void setPickupEnabled(bool enabled) noexcept;
+
+  // sets the shortest time CC values are coalesced before being sent, in
+  // milliseconds. The window grows with Lightroom's round trip, see
+  // SendRateControl
+  void setCoalesceWindow(int milliseconds) noexcept;
+
+  // stops the writer thread, anything not yet sent is dropped
+  void PleaseStopThread(void);
+
+  // state of the socket LR_IPC_IN reads from, combined with this one's in
+  // getConnectionState
+  void setInputState(CONNECTION_STATE state);
+
+  // CONNECTED when both sockets to the plugin are connected, CONNECTING while
+  // only one is and DISCONNECTED when neither is. Safe to call from any thread,
+  // e.g. from a LRConnectionListener
+  CONNECTION_STATE getConnectionState() const noexcept;
+
+  // number of one-shot commands dropped because too many were held while the
+  // plugin was away
+  uint32 getDroppedCommandCount() const noexcept;
+
   // MIDICommandListener interface
-  virtual void handleMidiCC(int midiChannel, int controller, int value) override;
-  virtual void handleMidiNote(int midiChannel, int note) override;
+  virtual void handleMidiCC(const CommandMapping& mapping,
+    const MIDI_Message& message, int value, int max_value,
+    double timestamp) override;
+  virtual void handleMidiNote(const CommandMapping& mapping,
+    const MIDI_Message& message, double timestamp) override;
 
 private:
+  // Observer interface, the command map changed so the subscription is resent
+  // once the edits stop for kSubscriptionDelay and only if it differs
+  virtual void Changed(Subject *changed) override;
+  // AsyncUpdater interface, tells the listeners the connection state changed
+  virtual void handleAsyncUpdate() override;
   // IPC interface
   virtual void connectionMade() override;
   virtual void connectionLost() override;
   virtual void messageReceived(const MemoryBlock& msg) override;
-  // AsyncUpdater interface
-  virtual void handleAsyncUpdate() override;
-  // Timer callback
-  virtual void timerCallback() override;
+  // Thread interface, writes queued commands and coalesced CC values to the
+  // socket and reconnects when the plugin goes away, so neither waits on the
+  // message thread
+  virtual void run() override;
+  // tries to connect, then waits out the backoff delay if that failed.
+  // connectToSocket blocks the writer thread for up to 100 ms while holding
+  // socket_mutex_, which only the destructor also takes
+  void Reconnect_();
+  // stores the socket's state and has the listeners told if it changed
+  void SetState_(CONNECTION_STATE state);
+  // while disconnected, drops the oldest one-shot commands beyond the limit on
+  // what is held for the plugin. Call with command_mutex_ held
+  void TrimHeld_();
+  // writes a batch, adding the coalesced CC values if drain_cc. The batch
+  // starts with command_lines one-shot commands, command_bytes long, which are
+  // held for the plugin if it has gone. Returns false if the socket was too
+  // backed up to take the CC values
+  bool Write_(std::string& batch, std::vector<double>& timestamps,
+    size_t command_bytes, size_t command_lines, bool drain_cc);
+  // appends the Subscribe line naming every mapped parameter, then a
+  // Snapshot request for their values. Without force nothing is appended if
+  // the plugin already has the same subscription
+  void AppendSubscription_(std::string& batch, std::vector<double>& timestamps,
+    bool force);
 
   Array<LRConnectionListener *> listeners_;
-  bool timer_off_{false};
+  std::atomic<CONNECTION_STATE> state_{CONNECTION_STATE::DISCONNECTED};
+  std::atomic<CONNECTION_STATE> input_state_{CONNECTION_STATE::DISCONNECTED};
+  // last state told to the listeners, message thread only
+  CONNECTION_STATE notified_state_{CONNECTION_STATE::DISCONNECTED};
+  ReconnectBackoff backoff_; // writer thread only
+  CCCoalescer coalescer_;
+  Takeover takeover_; // MIDI thread, except for the parameters' values
+  SendRateControl rate_;
+  std::vector<LRCommandId> drained_; // commands of the CC values written, writer thread only
+  std::atomic<int> coalesce_window_{30};
   const static unordered_map<String, KeyPress> keypress_mappings_;
   mutable std::mutex command_mutex_;
-  mutable std::mutex timer_mutex_; //fix race during shutdown
-  std::shared_ptr<const CommandMap> command_map_;
-  String command_;
+  mutable std::mutex socket_mutex_; //guards the socket between connecting and writing
+  std::condition_variable wake_;
+  std::shared_ptr<CommandMap> command_map_;
+  // Two outgoing lanes: command_ holds one-shot commands, sent as soon as the
+  // writer wakes and ahead of any parameter values; coalescer_ holds parameter
+  // values, sent at most once per window. Guarded by command_mutex_:
+  std::string command_; // commands and notes waiting for the writer
+  std::vector<double> command_timestamps_; // arrival of each line in command_
+  bool cc_pending_{false}; // coalescer_ has values
+  bool subscription_pending_{false}; // the plugin needs the mapped parameters
+  bool map_changed_{false}; // the subscription may be out of date
+  std::chrono::steady_clock::time_point map_changed_at_; // last map edit
+  std::string subscribed_; // last Subscribe line sent, writer thread only
+  std::atomic<uint32> dropped_commands_{0};
 };
 
 #endif  // LR_IPC_OUT_H_INCLUDED
@@ -0,0 +1,121 @@
+/*
+  ==============================================================================
+
+    LatencyStats.cpp
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#include "LatencyStats.h"
+#include <atomic>
+#include <cmath>
+
+namespace {
+  // bucket 0 holds times under 1 microsecond, bucket n those under 2^n
+  constexpr auto kBuckets = 32;
+
+  struct Histogram {
+    std::atomic<uint32> buckets[kBuckets];
+    std::atomic<uint32> count;
+    std::atomic<int64> total_us;
+    std::atomic<int64> max_us;
+  };
+
+  // static storage, the atomics start at zero
+  Histogram& GetHistogram(LATENCY_STAGE stage) noexcept {
+    static Histogram histograms[LatencyStats::kStageCount];
+    return histograms[static_cast<size_t>(stage)];
+  }
+
+  const char* StageName(int stage) noexcept {
+    static const char* const names[LatencyStats::kStageCount] = {
+      "MIDI in queue", "Mapping", "Coalescing", "Socket write",
+      "MIDI to Lightroom", "Lightroom line parse", "MIDI out queue",
+      "Lightroom to MIDI", "Lightroom round trip"};
+    return names[stage];
+  }
+
+  // upper bound of the bucket holding the given fraction of the samples, in
+  // milliseconds
+  double Percentile(const Histogram& histogram, uint32 count, double fraction) {
+    const auto target = static_cast<uint32>(std::ceil(count * fraction));
+    uint32 seen = 0;
+    for (auto bucket = 0; bucket < kBuckets; bucket++) {
+      seen += histogram.buckets[bucket].load(std::memory_order_relaxed);
+      if (seen >= target)
+        return static_cast<double>(int64{1} << bucket) / 1000.0;
+    }
+    return static_cast<double>(int64{1} << (kBuckets - 1)) / 1000.0;
+  }
+}
+
+double LatencyStats::now() noexcept {
+  return Time::getMillisecondCounterHiRes();
+}
+
+void LatencyStats::recordSince(LATENCY_STAGE stage, double start) noexcept {
+  if (start <= 0.0)
+    return;
+  const auto elapsed_us = jmax(int64{0},
+    static_cast<int64>((now() - start) * 1000.0));
+  auto bucket = 0;
+  while (bucket < kBuckets - 1 && elapsed_us >= (int64{1} << bucket))
+    bucket++;
+
+  auto& histogram = GetHistogram(stage);
+  histogram.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  histogram.total_us.fetch_add(elapsed_us, std::memory_order_relaxed);
+  histogram.count.fetch_add(1, std::memory_order_relaxed);
+  auto max_us = histogram.max_us.load(std::memory_order_relaxed);
+  while (elapsed_us > max_us &&
+    !histogram.max_us.compare_exchange_weak(max_us, elapsed_us)) {
+  }
+}
+
+String LatencyStats::getReport() {
+  auto report = String::formatted("%-22s %8s %7s %7s %7s %7s\n", "Stage (ms)",
+    "Count", "Mean", "p50", "p99", "Max");
+  for (auto stage = 0; stage < kStageCount; stage++) {
+    const auto& histogram = GetHistogram(static_cast<LATENCY_STAGE>(stage));
+    const auto count = histogram.count.load(std::memory_order_relaxed);
+    if (count == 0) {
+      report += String::formatted("%-22s %8u\n", StageName(stage), count);
+      continue;
+    }
+    const auto mean = histogram.total_us.load(std::memory_order_relaxed) /
+      1000.0 / count;
+    report += String::formatted("%-22s %8u %7.2f %7.2f %7.2f %7.2f\n",
+      StageName(stage), count, mean, Percentile(histogram, count, 0.5),
+      Percentile(histogram, count, 0.99),
+      histogram.max_us.load(std::memory_order_relaxed) / 1000.0);
+  }
+  return report;
+}
+
+bool LatencyStats::dumpToFile(const File& file, const String& extra) {
+  return file.replaceWithText(Time::getCurrentTime().toString(true, true) +
+    "\n" + getReport() + extra);
+}
+
+void LatencyStats::reset() noexcept {
+  for (auto stage = 0; stage < kStageCount; stage++) {
+    auto& histogram = GetHistogram(static_cast<LATENCY_STAGE>(stage));
+    for (auto& bucket : histogram.buckets)
+      bucket.store(0, std::memory_order_relaxed);
+    histogram.count.store(0, std::memory_order_relaxed);
+    histogram.total_us.store(0, std::memory_order_relaxed);
+    histogram.max_us.store(0, std::memory_order_relaxed);
+  }
+}
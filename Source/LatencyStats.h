@@ -0,0 +1,66 @@
+#pragma once
+/*
+  ==============================================================================
+
+    LatencyStats.h
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#ifndef LATENCYSTATS_H_INCLUDED
+#define LATENCYSTATS_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+// stages an event goes through, MIDI in to Lightroom and Lightroom to MIDI out
+enum class LATENCY_STAGE: uint8 {
+  MIDI_QUEUE, // driver callback to the dispatch thread
+  MAPPING, // mapping lookup and listeners on the dispatch thread
+  COALESCE, // waiting in the coalescer for the next flush
+  SOCKET_WRITE, // writing a flushed block to the plugin
+  TO_LR, // MIDI timestamp to written to the plugin
+  LR_PARSE, // line read from the plugin to queued for a device
+  MIDI_SEND, // queued for a device to accepted by it
+  FROM_LR, // line read from the plugin to accepted by a device
+  ROUND_TRIP, // value written to the plugin to the plugin acknowledging it
+};
+
+// Lock-free latency histograms, one per stage, filled from any thread. Times
+// are milliseconds on the clock of now(), which MIDI input timestamps use too.
+class LatencyStats {
+public:
+  static constexpr int kStageCount = 9;
+
+  // current time in milliseconds
+  static double now() noexcept;
+
+  // records the time from start to now. A start of 0 or less means the event
+  // wasn't traced and is ignored
+  static void recordSince(LATENCY_STAGE stage, double start) noexcept;
+
+  // one line per stage: count, mean, median, 99th percentile and maximum
+  static String getReport();
+
+  // writes the report, followed by extra, to a file, returns false if it
+  // couldn't be written
+  static bool dumpToFile(const File& file, const String& extra = String::empty);
+
+  static void reset() noexcept;
+
+private:
+  LatencyStats() noexcept;
+};
+
+#endif  // LATENCYSTATS_H_INCLUDED
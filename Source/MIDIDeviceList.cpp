@@ -0,0 +1,81 @@
+/*
+  ==============================================================================
+
+    MIDIDeviceList.cpp
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#include "MIDIDeviceList.h"
+#include <mutex>
+
+const int MIDIDeviceList::kAnyDevice = 0;
+
+namespace {
+  constexpr auto kMaxDevices = 255;
+
+  // names by id, id 0 is kAnyDevice
+  std::mutex& NamesMutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  StringArray& Names() {
+    static StringArray names{""};
+    return names;
+  }
+}
+
+int MIDIDeviceList::getDeviceId(const String& name) {
+  if (name.isEmpty())
+    return kAnyDevice;
+  std::lock_guard<std::mutex> lock(NamesMutex());
+  auto& names = Names();
+  const auto index = names.indexOf(name);
+  if (index >= 0)
+    return index;
+  if (names.size() > kMaxDevices)
+    return kAnyDevice;
+  names.add(name);
+  return names.size() - 1;
+}
+
+int MIDIDeviceList::getDeviceId(const StringArray& devices, int index) {
+  auto occurrence = 1;
+  for (auto idx = 0; idx < index; idx++) {
+    if (devices[idx] == devices[index])
+      occurrence++;
+  }
+  if (occurrence == 1)
+    return getDeviceId(devices[index]);
+  return getDeviceId(devices[index] + String::formatted(" (%d)", occurrence));
+}
+
+bool MIDIDeviceList::isRenumbered(const StringArray& previous,
+  const StringArray& devices, int index) {
+  const auto& name = devices[index];
+  auto count = 0;
+  for (const auto& device : devices)
+    count += (device == name);
+  auto previous_count = 0;
+  for (const auto& device : previous)
+    previous_count += (device == name);
+  return (count > 1 || previous_count > 1) && count != previous_count;
+}
+
+String MIDIDeviceList::getDeviceName(int id) {
+  std::lock_guard<std::mutex> lock(NamesMutex());
+  return Names()[id];
+}
@@ -0,0 +1,58 @@
+#pragma once
+/*
+  ==============================================================================
+
+    MIDIDeviceList.h
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#ifndef MIDIDEVICELIST_H_INCLUDED
+#define MIDIDEVICELIST_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+// Gives each MIDI device name a small id for use in mapping keys, so the same
+// controller gets the same id for its input and its output and across rescans.
+// Profiles store the name, ids are only valid for the life of the process.
+class MIDIDeviceList {
+public:
+  // id of "any device", used by mappings that don't name a device
+  static const int kAnyDevice;
+
+  // returns the id of a device name, registering it if needed. Returns
+  // kAnyDevice for an empty name or when all ids are used
+  static int getDeviceId(const String& name);
+
+  // id of the device at index in a list from MidiInput::getDevices or
+  // MidiOutput::getDevices. A repeated name gets " (2)", " (3)"... added, so
+  // identical controllers are told apart by the order they are listed in
+  static int getDeviceId(const StringArray& devices, int index);
+
+  // true if the device at index shares its name with other devices and the
+  // number of devices with that name differs from previous, the list from the
+  // last rescan. The ids of such a group can now point at different physical
+  // devices, so all of the group must be closed and opened again
+  static bool isRenumbered(const StringArray& previous, const StringArray& devices,
+    int index);
+
+  // returns the name of a registered id, or an empty string for kAnyDevice
+  static String getDeviceName(int id);
+
+private:
+  MIDIDeviceList() noexcept;
+};
+
+#endif  // MIDIDEVICELIST_H_INCLUDED
@@ -0,0 +1,73 @@
+/*
+  ==============================================================================
+
+    MIDIDeviceWatcher.cpp
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#include "MIDIDeviceWatcher.h"
+
+constexpr auto kPollInterval = 1000; // milliseconds
+
+MIDIDeviceWatcher::MIDIDeviceWatcher() noexcept: Thread{"MIDIDeviceWatcher"} {}
+
+MIDIDeviceWatcher::~MIDIDeviceWatcher() {
+  PleaseStopThread();
+}
+
+void MIDIDeviceWatcher::Init(std::shared_ptr<MIDIProcessor>& midi_processor,
+  std::shared_ptr<MIDISender>& midi_sender,
+  std::shared_ptr<LR_IPC_IN>& lr_ipc_in) noexcept {
+  midi_processor_ = midi_processor;
+  midi_sender_ = midi_sender;
+  lr_ipc_in_ = lr_ipc_in;
+  // the lists start empty, so the first poll picks up anything attached since
+  // midi_processor and midi_sender were initialized
+}
+
+void MIDIDeviceWatcher::PleaseStopThread(void) {
+  cancelPendingUpdate();
+  signalThreadShouldExit();
+  notify();
+  stopThread(1000);
+}
+
+void MIDIDeviceWatcher::run() {
+  while (!threadShouldExit()) {
+    wait(kPollInterval);
+    if (threadShouldExit())
+      break;
+    const auto inputs = MidiInput::getDevices();
+    if (inputs != inputs_) {
+      inputs_ = inputs;
+      if (midi_processor_)
+        midi_processor_->rescanDevices();
+    }
+    const auto outputs = MidiOutput::getDevices();
+    if (outputs != outputs_) {
+      outputs_ = outputs;
+      if (midi_sender_ && midi_sender_->rescanDevices())
+        triggerAsyncUpdate();
+    }
+  }
+}
+
+void MIDIDeviceWatcher::handleAsyncUpdate() {
+    // only the new outputs have unknown values, the rest are skipped by the
+    // sender's cache
+  if (lr_ipc_in_)
+    lr_ipc_in_->refreshMIDIOutput(false);
+}
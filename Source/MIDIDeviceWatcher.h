@@ -0,0 +1,58 @@
+#pragma once
+/*
+  ==============================================================================
+
+    MIDIDeviceWatcher.h
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#ifndef MIDIDEVICEWATCHER_H_INCLUDED
+#define MIDIDEVICEWATCHER_H_INCLUDED
+
+#include <memory>
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "LR_IPC_In.h"
+#include "MIDIProcessor.h"
+#include "MIDISender.h"
+
+// polls the MIDI device lists and, when a device is plugged in or removed,
+// opens or closes just that device. Devices left alone keep their state
+class MIDIDeviceWatcher: public Thread, private AsyncUpdater {
+public:
+  MIDIDeviceWatcher() noexcept;
+  virtual ~MIDIDeviceWatcher();
+
+  void Init(std::shared_ptr<MIDIProcessor>& midi_processor,
+    std::shared_ptr<MIDISender>& midi_sender,
+    std::shared_ptr<LR_IPC_IN>& lr_ipc_in) noexcept;
+
+  void PleaseStopThread(void);
+
+private:
+  // Thread interface
+  virtual void run() override;
+
+  // AsyncUpdater interface, sends the current values to new outputs
+  virtual void handleAsyncUpdate() override;
+
+  std::shared_ptr<MIDIProcessor> midi_processor_;
+  std::shared_ptr<MIDISender> midi_sender_;
+  std::shared_ptr<LR_IPC_IN> lr_ipc_in_;
+  StringArray inputs_; // device lists as last seen
+  StringArray outputs_;
+};
+
+#endif  // MIDIDEVICEWATCHER_H_INCLUDED
@@ -19,47 +19,244 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
   ==============================================================================
 */
 #include "MIDIProcessor.h"
+#include "MIDIDeviceList.h"
 
-MIDIProcessor::MIDIProcessor() noexcept {}
+#include <algorithm>
+#include <cmath>
 
-MIDIProcessor::~MIDIProcessor() {}
+MIDIProcessor::MIDIProcessor() noexcept: Thread{"MIDIProcessor"} {}
 
-void MIDIProcessor::Init(void) {
-  InitDevices_();
+MIDIProcessor::~MIDIProcessor() {
+  PleaseStopThread();
 }
 
-void MIDIProcessor::handleIncomingMidiMessage(MidiInput * /*device*/,
+void MIDIProcessor::Init(std::shared_ptr<CommandMap>& command_map) {
+  decoded_.reserve(64);
+  command_map_ = command_map;
+  rescanDevices();
+}
+
+void MIDIProcessor::Start() {
+  startThread();
+}
+
+MIDIProcessor::InputDevice::InputDevice(MIDIProcessor& processor, int id) noexcept:
+  owner(processor), device_id{id} {}
+
+void MIDIProcessor::InputDevice::handleIncomingMidiMessage(MidiInput* /*device*/,
   const MidiMessage &message) {
-  if (message.isController()) {
-    for (auto listener : listeners_) {
-      listener->handleMidiCC(message.getChannel(),
-        message.getControllerNumber(), message.getControllerValue());
+    // runs on the driver's thread: copy the message into the device's ring and
+    // return, never block or allocate here
+  const auto start_ticks = Time::getHighResolutionTicks();
+  const auto size = message.getRawDataSize();
+  if (size > 0 && size <= 3) {
+    const auto* raw = message.getRawData();
+    int start1, size1, start2, size2;
+    fifo.prepareToWrite(1, start1, size1, start2, size2);
+    if (size1 > 0) {
+      // the driver's timestamp is in seconds on the LatencyStats clock, not all
+      // drivers set it
+      const auto timestamp = message.getTimeStamp() > 0.0 ?
+        message.getTimeStamp() * 1000.0 : LatencyStats::now();
+      events[start1] = {static_cast<uint8>(device_id), raw[0],
+        size > 1 ? raw[1] : uint8{0}, size > 2 ? raw[2] : uint8{0},
+        static_cast<uint8>(size), timestamp};
+      fifo.finishedWrite(1);
+      owner.notify();
     }
+    else
+      ++owner.dropped_events_;
   }
-  else if (message.isNoteOn()) {
-    for (auto listener : listeners_) {
-      listener->handleMidiNote(message.getChannel(), message.getNoteNumber());
-    }
+
+  const auto elapsed = Time::getHighResolutionTicks() - start_ticks;
+  auto max_ticks = owner.max_callback_ticks_.load(std::memory_order_relaxed);
+  while (elapsed > max_ticks &&
+    !owner.max_callback_ticks_.compare_exchange_weak(max_ticks, elapsed)) {
   }
 }
 
-void MIDIProcessor::addMIDICommandListener(MIDICommandListener* listener) {
-  listeners_.addIfNotAlreadyThere(listener);
+void MIDIProcessor::addMIDICommandListener(MIDICommandListener* listener,
+  uint32 kinds) {
+    // the dispatch thread calls the listeners with inputs_mutex_ held
+  std::lock_guard<decltype(inputs_mutex_)> lock(inputs_mutex_);
+  for (auto& entry : listeners_) {
+    if (entry.listener == listener) {
+      entry.kinds |= kinds;
+      return;
+    }
+  }
+  listeners_.push_back({listener, kinds});
 }
 
 void MIDIProcessor::rescanDevices() {
-  for (auto dev : devices_)
-    dev->stop();
-  devices_.clear(true);
+  std::lock_guard<decltype(rescan_mutex_)> rescan_lock(rescan_mutex_);
+  const auto names = MidiInput::getDevices();
+  std::vector<int> ids;
+  std::vector<int> renumbered;
+  for (auto idx = 0; idx < names.size(); idx++) {
+    ids.push_back(MIDIDeviceList::getDeviceId(names, idx));
+    if (MIDIDeviceList::isRenumbered(device_names_, names, idx))
+      renumbered.push_back(ids.back());
+  }
+  device_names_ = names;
+
+  if (!renumbered.empty()) {
+      // identical devices were added or removed: close the whole group so each
+      // is opened again under the id of its current position
+    OwnedArray<InputDevice> reopened; // deleted after the lock is released
+    std::lock_guard<decltype(inputs_mutex_)> lock(inputs_mutex_);
+    for (auto idx = inputs_.size(); --idx >= 0;) {
+      if (std::find(renumbered.begin(), renumbered.end(),
+        inputs_[idx]->device_id) != renumbered.end()) {
+        inputs_[idx]->input->stop();
+        reopened.add(inputs_.removeAndReturn(idx));
+      }
+    }
+  }
+
+  // open the new devices before taking the lock, opening can be slow
+  OwnedArray<InputDevice> opened;
+  for (auto idx = 0; idx < names.size(); idx++) {
+    auto already_open = false;
+    {
+      std::lock_guard<decltype(inputs_mutex_)> lock(inputs_mutex_);
+      for (auto input : inputs_)
+        already_open |= (input->device_id == ids[static_cast<size_t>(idx)]);
+    }
+    if (already_open)
+      continue;
+    std::unique_ptr<InputDevice> device{new InputDevice{*this,
+      ids[static_cast<size_t>(idx)]}};
+    device->input.reset(MidiInput::openDevice(idx, device.get()));
+    if (device->input) {
+      DBG(device->input->getName());
+      opened.add(device.release());
+    }
+  }
+
+  OwnedArray<InputDevice> closed; // deleted after the lock is released
+  {
+    std::lock_guard<decltype(inputs_mutex_)> lock(inputs_mutex_);
+    for (auto idx = inputs_.size(); --idx >= 0;) {
+      if (std::find(ids.begin(), ids.end(), inputs_[idx]->device_id) == ids.end()) {
+        inputs_[idx]->input->stop();
+        closed.add(inputs_.removeAndReturn(idx));
+      }
+    }
+    for (auto device : opened)
+      inputs_.add(device);
+  }
+  for (auto device : opened)
+    device->input->start();
+  opened.clear(false); // now owned by inputs_
+}
+
+void MIDIProcessor::PleaseStopThread(void) {
+  {
+    std::lock_guard<decltype(inputs_mutex_)> lock(inputs_mutex_);
+    for (auto device : inputs_)
+      device->input->stop();
+  }
+  signalThreadShouldExit();
+  notify();
+  stopThread(1000);
+}
+
+double MIDIProcessor::getMaxCallbackMicroseconds() const noexcept {
+  return Time::highResolutionTicksToSeconds(max_callback_ticks_.load()) * 1.0e6;
+}
+
+uint32 MIDIProcessor::getDroppedEventCount() const noexcept {
+  return dropped_events_.load();
+}
+
+void MIDIProcessor::run() {
+  while (!threadShouldExit()) {
+    auto next_deadline = 0.0;
+    {
+      std::lock_guard<decltype(inputs_mutex_)> lock(inputs_mutex_);
+      for (auto device : inputs_) {
+        int start1, size1, start2, size2;
+        device->fifo.prepareToRead(device->fifo.getNumReady(), start1, size1,
+          start2, size2);
+        for (auto idx = 0; idx < size1; idx++)
+          DispatchEvent_(*device, device->events[start1 + idx]);
+        for (auto idx = 0; idx < size2; idx++)
+          DispatchEvent_(*device, device->events[start2 + idx]);
+        device->fifo.finishedRead(size1 + size2);
+        // an MSB whose LSB didn't arrive in time goes out on its own
+        const auto now = LatencyStats::now();
+        device->decoder.flushExpired(now, decoded_);
+        DispatchControllers_(device->device_id,
+          now - ControllerDecoder::kLsbTimeout);
+        const auto deadline = device->decoder.nextDeadline();
+        if (deadline > 0.0 && (next_deadline <= 0.0 || deadline < next_deadline))
+          next_deadline = deadline;
+      }
+    }
+    //woken by a device's callback or PleaseStopThread, or when an MSB is due
+    if (next_deadline > 0.0)
+      wait(jmax(1, static_cast<int>(std::ceil(next_deadline -
+        LatencyStats::now()))));
+    else
+      wait(-1);
+  }
+}
+
+void MIDIProcessor::DispatchEvent_(InputDevice& device, const MIDIEvent& event) {
+    // resolve the message once, then call only the listeners interested in
+    // its kind of action
+  LatencyStats::recordSince(LATENCY_STAGE::MIDI_QUEUE, event.timestamp);
+  // MidiMessage checks that the byte count matches the status
+  const auto message = event.size == 1 ? MidiMessage{event.status} :
+    event.size == 2 ? MidiMessage{event.status, event.data1} :
+    MidiMessage{event.status, event.data1, event.data2};
+  if (message.isController()) {
+    const auto channel = message.getChannel();
+    const auto controller = message.getControllerNumber();
+    MIDI_Message cc{channel, controller, true};
+    cc.device = device.device_id;
+      // the LSB of a 14-bit controller goes out as its MSB, which is looked up
+      // when the pair is complete
+    const auto mapping = device.decoder.isFourteenBitLsb(channel, controller) ?
+      CommandMap::kNoMapping : Lookup_(cc);
+    device.decoder.process(channel, controller, message.getControllerValue(),
+      mapping.resolution == CC_RESOLUTION::CC14, event.timestamp, decoded_);
+    DispatchControllers_(device.device_id, event.timestamp, cc, mapping);
+  }
+  else if (message.isNoteOn()) {
+    const auto start = LatencyStats::now();
+    MIDI_Message note{message.getChannel(), message.getNoteNumber(), false};
+    note.device = device.device_id;
+    const auto mapping = Lookup_(note);
+    const auto mask = ActionKindMask(mapping.kind);
+    for (const auto& entry : listeners_) {
+      if (entry.kinds & mask)
+        entry.listener->handleMidiNote(mapping, note, event.timestamp);
+    }
+    LatencyStats::recordSince(LATENCY_STAGE::MAPPING, start);
+  }
+}
 
-  InitDevices_();
+CommandMapping MIDIProcessor::Lookup_(const MIDI_Message& message) const noexcept {
+  return command_map_ ? command_map_->getMappingForMessage(message) :
+    CommandMap::kNoMapping;
 }
 
-void MIDIProcessor::InitDevices_() {
-  for (auto idx = 0; idx < MidiInput::getDevices().size(); idx++) {
-    if (devices_.set(idx, MidiInput::openDevice(idx, this))) {
-      devices_[idx]->start();
-      DBG(devices_[idx]->getName());
+void MIDIProcessor::DispatchControllers_(int device_id, double timestamp,
+  const MIDI_Message& resolved, const CommandMapping& resolved_mapping) {
+  for (auto& event : decoded_) {
+    const auto start = LatencyStats::now();
+    event.message.device = device_id;
+    const auto mapping = event.message == resolved ? resolved_mapping :
+      Lookup_(event.message);
+    const auto mask = ActionKindMask(mapping.kind);
+    for (const auto& entry : listeners_) {
+      if (entry.kinds & mask)
+        entry.listener->handleMidiCC(mapping, event.message, event.value,
+          event.max_value, timestamp);
     }
+    LatencyStats::recordSince(LATENCY_STAGE::MAPPING, start);
   }
+  decoded_.clear();
 }
@@ -22,34 +22,109 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef MIDIPROCESSOR_H_INCLUDED
 #define MIDIPROCESSOR_H_INCLUDED
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "CommandMap.h"
+#include "ControllerDecoder.h"
+#include "LatencyStats.h"
+
+// compact copy of an incoming MIDI message, queued by the driver callback and
+// consumed by the dispatch thread
+struct MIDIEvent {
+  uint8 device;
+  uint8 status;
+  uint8 data1;
+  uint8 data2;
+  uint8 size; // 1 to 3 bytes, data bytes past it are 0
+  double timestamp; // arrival, in LatencyStats::now() milliseconds
+};
 
 class MIDICommandListener {
 public:
-  virtual void handleMidiCC(int midi_channel, int controller, int value) = 0;
-  virtual void handleMidiNote(int midi_channel, int note) = 0;
+  // mapping is the message resolved against the command map by MIDIProcessor.
+  // value runs from 0 to max_value, which is 127 for a 7-bit controller and
+  // 16383 for a 14-bit controller or an NRPN. timestamp is when the message
+  // arrived, in LatencyStats::now() milliseconds
+  virtual void handleMidiCC(const CommandMapping& mapping,
+    const MIDI_Message& message, int value, int max_value, double timestamp) = 0;
+  virtual void handleMidiNote(const CommandMapping& mapping,
+    const MIDI_Message& message, double timestamp) = 0;
 
   virtual ~MIDICommandListener() {};
 };
 
-class MIDIProcessor: public MidiInputCallback {
+class MIDIProcessor: private Thread {
 public:
   MIDIProcessor() noexcept;
   virtual ~MIDIProcessor();
-  void Init(void);
+  void Init(std::shared_ptr<CommandMap>& command_map);
 
-  // overridden from MidiInputCallback
-  void handleIncomingMidiMessage(MidiInput*, const MidiMessage&) override;
+  // starts dispatching, call once every listener has been added so none misses
+  // the first messages
+  void Start();
 
-  void addMIDICommandListener(MIDICommandListener*);
+  // the listener is only called for messages whose action kind is in kinds,
+  // see ActionKindMask
+  void addMIDICommandListener(MIDICommandListener*, uint32 kinds = kAllActionKinds);
 
-  // re-enumerates MIDI IN devices
+  // opens MIDI IN devices that have appeared and closes those that have gone,
+  // devices still present keep running
   void rescanDevices();
 
+  // stops the MIDI IN devices and the dispatch thread
+  void PleaseStopThread(void);
+
+  // worst-case time spent in a device's callback, in microseconds
+  double getMaxCallbackMicroseconds() const noexcept;
+
+  // number of messages dropped because a device's queue was full
+  uint32 getDroppedEventCount() const noexcept;
+
 private:
-  void InitDevices_();
-  Array<MIDICommandListener *> listeners_;
-  OwnedArray<MidiInput> devices_;
+  // one open MIDI IN device. Its callback runs on the driver's thread and only
+  // queues the message in the ring: single producer (the callback), single
+  // consumer (dispatch thread)
+  struct InputDevice: public MidiInputCallback {
+    InputDevice(MIDIProcessor& processor, int id) noexcept;
+    virtual void handleIncomingMidiMessage(MidiInput*, const MidiMessage&) override;
+
+    static constexpr int kSize = 1024;
+    MIDIProcessor& owner;
+    const int device_id; // see MIDIDeviceList
+    AbstractFifo fifo{kSize};
+    MIDIEvent events[kSize];
+    ControllerDecoder decoder; // only used by the dispatch thread
+    std::unique_ptr<MidiInput> input; // declared last, closed first
+  };
+
+  // Thread interface
+  virtual void run() override;
+  void DispatchEvent_(InputDevice& device, const MIDIEvent& event);
+  // mapping of a message, kNoMapping without a map
+  CommandMapping Lookup_(const MIDI_Message& message) const noexcept;
+  // calls the listeners for the events in decoded_. An event for the resolved
+  // message uses resolved_mapping, any other is looked up
+  void DispatchControllers_(int device_id, double timestamp,
+    const MIDI_Message& resolved = MIDI_Message{},
+    const CommandMapping& resolved_mapping = CommandMap::kNoMapping);
+
+  struct ListenerEntry {
+    MIDICommandListener* listener;
+    uint32 kinds;
+  };
+
+  std::shared_ptr<const CommandMap> command_map_{nullptr};
+  std::vector<ListenerEntry> listeners_; // guarded by inputs_mutex_
+  OwnedArray<InputDevice> inputs_; // guarded by inputs_mutex_
+  std::vector<ControllerDecoder::Event> decoded_; // reused by DispatchEvent_
+  std::mutex inputs_mutex_;
+  std::mutex rescan_mutex_;
+  StringArray device_names_; // at the last rescan, guarded by rescan_mutex_
+  std::atomic<int64> max_callback_ticks_{0};
+  std::atomic<uint32> dropped_events_{0};
 };
 
 #endif  // MIDIPROCESSOR_H_INCLUDED
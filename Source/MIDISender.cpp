@@ -19,30 +19,306 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
   ==============================================================================
 */
 #include "MIDISender.h"
+#include "LatencyStats.h"
+#include "MIDIDeviceList.h"
 
-MIDISender::MIDISender() noexcept {}
+#include <algorithm>
+
+constexpr auto kUnknownValue = -1;
+constexpr auto kDefaultHoldTime = 300; // milliseconds
+
+MIDISender::MIDISender() noexcept: hold_time_{kDefaultHoldTime} {}
 
 MIDISender::~MIDISender() {}
 
-void MIDISender::Init(void) {
-  InitDevices_();
+void MIDISender::Init(std::shared_ptr<MIDIProcessor>& midi_processor) {
+  if (midi_processor) {
+    midi_processor->addMIDICommandListener(this,
+      ActionKindMask(ACTION_KIND::SEND_TO_LR));
+  }
+  rescanDevices();
 }
 
-void MIDISender::sendCC(int midi_channel, int controller, int value) const {
-  for (auto dev : output_devices)
-    dev->sendMessageNow(MidiMessage::controllerEvent(midi_channel, controller,
-    value));
+void MIDISender::sendCC(const MIDI_Message& message, int value,
+  FEEDBACK_FORMAT format, double timestamp) {
+  value = jlimit(0, kMaxFeedbackValue, value);
+  // only CC 0-31 have an LSB controller
+  if (format == FEEDBACK_FORMAT::CC14 &&
+    (message.controller < 0 || message.controller > 31))
+    format = FEEDBACK_FORMAT::CC7;
+  // rounded to the nearest of the 128 steps
+  if (format == FEEDBACK_FORMAT::CC7)
+    value = (value * 127 + kMaxFeedbackValue / 2) / kMaxFeedbackValue;
+  const auto index = CacheIndex_(message.channel, message.controller, format);
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  const auto send_to_all = !HasDevice_(message.device);
+  for (auto dev : output_devices) {
+    if (!send_to_all && dev->getDeviceId() != message.device)
+      continue;
+    auto& last_sent = dev->lastSent();
+    if (index >= 0) {
+      if (last_sent[index] == value)
+        continue; // device already shows it
+      last_sent[index] = value;
+    }
+    dev->enqueue(message, value, format, index, timestamp);
+    LatencyStats::recordSince(LATENCY_STAGE::LR_PARSE, timestamp);
+  }
 }
 
-void MIDISender::rescanDevices() {
-  output_devices.clear(true);
-  InitDevices_();
+void MIDISender::setHoldTime(int milliseconds) noexcept {
+  hold_time_ = jmax(0, milliseconds);
 }
 
-void MIDISender::InitDevices_() {
-  for (auto idx = 0; idx < MidiOutput::getDevices().size(); idx++) {
+void MIDISender::forceResync() {
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  for (auto dev : output_devices)
+    dev->lastSent().fill(kUnknownValue);
+}
+
+bool MIDISender::rescanDevices() {
+  std::lock_guard<decltype(rescan_mutex_)> rescan_lock(rescan_mutex_);
+  const auto names = MidiOutput::getDevices();
+  std::vector<int> ids;
+  std::vector<int> renumbered;
+  for (auto idx = 0; idx < names.size(); idx++) {
+    ids.push_back(MIDIDeviceList::getDeviceId(names, idx));
+    if (MIDIDeviceList::isRenumbered(device_names_, names, idx))
+      renumbered.push_back(ids.back());
+  }
+  device_names_ = names;
+
+  if (!renumbered.empty()) {
+      // identical devices were added or removed: close the whole group so each
+      // is opened again under the id of its current position
+    OwnedArray<DeviceWriter> reopened; // writers stopped after the lock is released
+    std::lock_guard<decltype(mutex_)> lock(mutex_);
+    for (auto idx = output_devices.size(); --idx >= 0;) {
+      if (std::find(renumbered.begin(), renumbered.end(),
+        output_devices[idx]->getDeviceId()) != renumbered.end())
+        reopened.add(output_devices.removeAndReturn(idx));
+    }
+  }
+
+  // open the new devices before taking the lock, opening can be slow
+  OwnedArray<DeviceWriter> opened;
+  for (auto idx = 0; idx < names.size(); idx++) {
+    const auto device_id = ids[static_cast<size_t>(idx)];
+    {
+      std::lock_guard<decltype(mutex_)> lock(mutex_);
+      if (HasDevice_(device_id))
+        continue;
+    }
     auto dev = MidiOutput::openDevice(idx);
     if (dev != nullptr)
-      output_devices.set(idx, dev);
+      opened.add(new DeviceWriter(dev, device_id, metrics_, hold_time_));
+  }
+
+  OwnedArray<DeviceWriter> closed; // writers stopped after the lock is released
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  for (auto idx = output_devices.size(); --idx >= 0;) {
+    if (std::find(ids.begin(), ids.end(), output_devices[idx]->getDeviceId()) ==
+      ids.end())
+      closed.add(output_devices.removeAndReturn(idx));
+  }
+  const auto added = opened.size() > 0;
+  for (auto dev : opened)
+    output_devices.add(dev);
+  opened.clear(false); // now owned by output_devices
+  return added;
+}
+
+int MIDISender::getQueueDepth() const noexcept {
+  return metrics_.queued.load();
+}
+
+int MIDISender::getMaxQueueDepth() const noexcept {
+  return metrics_.max_queued.load();
+}
+
+double MIDISender::getMaxSendLatencyMicroseconds() const noexcept {
+  return Time::highResolutionTicksToSeconds(
+    metrics_.max_latency_ticks.load()) * 1.0e6;
+}
+
+void MIDISender::handleMidiCC(const CommandMapping& mapping,
+  const MIDI_Message& message, int /*value*/, int /*max_value*/,
+  double /*timestamp*/) {
+    // a relative encoder has no position of its own to fight the feedback,
+    // and an NRPN has no cached value
+  if (mapping.mode != CC_MODE::ABS)
+    return;
+  const auto index = CacheIndex_(message.channel, message.controller,
+    mapping.feedback);
+  if (index < 0)
+    return;
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  const auto all_devices = !HasDevice_(message.device);
+  for (auto dev : output_devices) {
+    if (all_devices || dev->getDeviceId() == message.device) {
+      dev->lastSent()[index] = kUnknownValue;
+      dev->touch(index);
+    }
+  }
+}
+
+void MIDISender::handleMidiNote(const CommandMapping& /*mapping*/,
+  const MIDI_Message& /*message*/, double /*timestamp*/) {}
+
+bool MIDISender::HasDevice_(int device_id) const noexcept {
+  if (device_id == MIDIDeviceList::kAnyDevice)
+    return false;
+  for (auto dev : output_devices) {
+    if (dev->getDeviceId() == device_id)
+      return true;
+  }
+  return false;
+}
+
+int MIDISender::BuildMessages_(const MIDI_Message& message, int value,
+  FEEDBACK_FORMAT format, MidiMessage* out) {
+  auto count = 0;
+  switch (format) {
+    case FEEDBACK_FORMAT::CC14:
+      out[count++] = MidiMessage::controllerEvent(message.channel,
+        message.controller, value >> 7);
+      out[count++] = MidiMessage::controllerEvent(message.channel,
+        message.controller + 32, value & 0x7F);
+      break;
+    case FEEDBACK_FORMAT::NRPN:
+      out[count++] = MidiMessage::controllerEvent(message.channel, 99,
+        (message.controller >> 7) & 0x7F);
+      out[count++] = MidiMessage::controllerEvent(message.channel, 98,
+        message.controller & 0x7F);
+      out[count++] = MidiMessage::controllerEvent(message.channel, 6,
+        value >> 7);
+      out[count++] = MidiMessage::controllerEvent(message.channel, 38,
+        value & 0x7F);
+      break;
+    case FEEDBACK_FORMAT::PITCH_BEND:
+      out[count++] = MidiMessage::pitchWheel(message.channel, value);
+      break;
+    default:
+      out[count++] = MidiMessage::controllerEvent(message.channel,
+        message.controller, value);
+      break;
+  }
+  return count;
+}
+
+int MIDISender::CacheIndex_(int midi_channel, int controller,
+  FEEDBACK_FORMAT format) noexcept {
+  if (midi_channel < 1 || midi_channel > 16 || format == FEEDBACK_FORMAT::NRPN)
+    return -1;
+  if (format == FEEDBACK_FORMAT::PITCH_BEND)
+    return 16 * 128 + midi_channel - 1;
+  if (controller < 0 || controller > 127)
+    return -1;
+  return (midi_channel - 1) * 128 + controller;
+}
+
+MIDISender::DeviceWriter::DeviceWriter(MidiOutput* device, int device_id,
+  SendMetrics& metrics, const std::atomic<int>& hold_time):
+  Thread{"MIDISender " + device->getName()},
+  device_{device}, device_id_{device_id}, metrics_(metrics),
+  hold_time_(hold_time), held_(kCacheSize), touched_{kCacheSize} {
+  last_sent_.fill(kUnknownValue);
+  startThread();
+}
+
+MIDISender::DeviceWriter::~DeviceWriter() {
+  signalThreadShouldExit();
+  notify();
+  stopThread(1000);
+  metrics_.queued -= pending_count_; // never sent
+}
+
+void MIDISender::DeviceWriter::enqueue(const MIDI_Message& message, int value,
+  FEEDBACK_FORMAT format, int index, double timestamp) {
+  {
+    std::lock_guard<decltype(mutex_)> lock(mutex_);
+    if (touched_.isScheduled(index)) {
+      // the control is under the user's hand, only its last value goes out
+      held_[static_cast<size_t>(index)] = {message, value, format, true};
+      return;
+    }
+    Queue_(message, value, format, timestamp);
+  }
+  notify();
+}
+
+void MIDISender::DeviceWriter::touch(int index) {
+  const auto hold_time = hold_time_.load();
+  if (hold_time <= 0 || index < 0)
+    return;
+  {
+    std::lock_guard<decltype(mutex_)> lock(mutex_);
+    touched_.schedule(index, Time::getMillisecondCounterHiRes() + hold_time);
+  }
+  notify(); // run waits for the deadline
+}
+
+void MIDISender::DeviceWriter::Queue_(const MIDI_Message& message, int value,
+  FEEDBACK_FORMAT format, double timestamp) {
+  MidiMessage messages[4];
+  const auto count = BuildMessages_(message, value, format, messages);
+  if (pending_count_ == 0)
+    oldest_pending_ticks_ = Time::getHighResolutionTicks();
+    // events at the same position stay in the order they were added
+  for (auto idx = 0; idx < count; ++idx)
+    pending_.addEvent(messages[idx], 0);
+  pending_traces_.push_back({timestamp, LatencyStats::now()});
+  pending_count_ += count;
+  const auto queued = (metrics_.queued += count);
+  auto max_queued = metrics_.max_queued.load(std::memory_order_relaxed);
+  while (queued > max_queued &&
+    !metrics_.max_queued.compare_exchange_weak(max_queued, queued)) {
+  }
+}
+
+void MIDISender::DeviceWriter::run() {
+  MidiBuffer batch;
+  std::vector<Trace> traces;
+  while (!threadShouldExit()) {
+    auto batch_count = 0;
+    int64 oldest_ticks;
+    bool holding;
+    {
+      std::lock_guard<decltype(mutex_)> lock(mutex_);
+        // controls left alone for the hold time get their last value
+      touched_.advance(Time::getMillisecondCounterHiRes(), [this](int index) {
+        auto& held = held_[static_cast<size_t>(index)];
+        if (held.pending) {
+          held.pending = false;
+          Queue_(held.message, held.value, held.format, 0.0); // not latency
+        }
+      });
+      holding = !touched_.empty();
+      batch.swapWith(pending_);
+      traces.swap(pending_traces_);
+      batch_count = pending_count_;
+      pending_count_ = 0;
+      oldest_ticks = oldest_pending_ticks_;
+    }
+    if (batch_count == 0) {
+      // enqueue and touch notify
+      wait(holding ? static_cast<int>(TimerWheel::tickLength()) : -1);
+      continue;
+    }
+    // everything queued since the last pass goes out in one block
+    device_->sendBlockOfMessagesNow(batch);
+    batch.clear();
+    for (const auto& trace : traces) {
+      LatencyStats::recordSince(LATENCY_STAGE::MIDI_SEND, trace.queued);
+      LatencyStats::recordSince(LATENCY_STAGE::FROM_LR, trace.timestamp);
+    }
+    traces.clear();
+    metrics_.queued -= batch_count;
+
+    const auto latency = Time::getHighResolutionTicks() - oldest_ticks;
+    auto max_latency = metrics_.max_latency_ticks.load(std::memory_order_relaxed);
+    while (latency > max_latency &&
+      !metrics_.max_latency_ticks.compare_exchange_weak(max_latency, latency)) {
+    }
   }
 }
@@ -22,23 +22,144 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef MIDISENDER_H_INCLUDED
 #define MIDISENDER_H_INCLUDED
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "MIDIProcessor.h"
+#include "TimerWheel.h"
 
-class MIDISender {
+class MIDISender: public MIDICommandListener {
 public:
   MIDISender() noexcept;
   virtual ~MIDISender();
-  void Init();
+  void Init(std::shared_ptr<MIDIProcessor>& midi_processor);
 
-  // sends a CC message to all output devices
-  void sendCC(int midi_channel, int controller, int value) const;
+  // sends a value, 0-kMaxFeedbackValue, to the output device of the message's
+  // device, or to every output if it has none, skipping devices already
+  // showing that value. format decides the messages and how many steps the
+  // device sees. timestamp is when the value was read from the plugin, see
+  // LatencyStats
+  void sendCC(const MIDI_Message& message, int value,
+    FEEDBACK_FORMAT format = FEEDBACK_FORMAT::CC7, double timestamp = 0.0);
 
-  // re-enumerates MIDI OUT devices
-  void rescanDevices();
+  // how long feedback to a control is held back after it was last moved by
+  // hand, so a motor fader doesn't fight the user. The last value held is sent
+  // once the control has been still that long. 0 turns holding off
+  void setHoldTime(int milliseconds) noexcept;
+
+  // forgets what the devices show, so the next sendCC of every control goes
+  // out. Used when the devices or the mappings change
+  void forceResync();
+
+  // opens MIDI OUT devices that have appeared and closes those that have gone.
+  // Devices still present keep what they were last sent. Returns true if an
+  // output was opened, it doesn't show any values yet
+  bool rescanDevices();
+
+  // messages queued for the output devices but not yet sent
+  int getQueueDepth() const noexcept;
+
+  // most messages that have been queued at once
+  int getMaxQueueDepth() const noexcept;
+
+  // worst-case time from queueing a message to the device accepting it, in
+  // microseconds
+  double getMaxSendLatencyMicroseconds() const noexcept;
+
+  // MIDICommandListener interface, an absolute control moved by hand no
+  // longer shows the value last sent to it, and its feedback is held
+  virtual void handleMidiCC(const CommandMapping& mapping,
+    const MIDI_Message& message, int value, int max_value,
+    double timestamp) override;
+  virtual void handleMidiNote(const CommandMapping& mapping,
+    const MIDI_Message& message, double timestamp) override;
 
 private:
-  void InitDevices_();
-  OwnedArray<MidiOutput> output_devices;
+  static constexpr int kCacheSize = 16 * 128 + 16;
+  // last value sent for each channel and controller, then for each channel's
+  // pitch wheel, in the resolution it was sent. -1 if unknown
+  using SentValues = std::array<int, kCacheSize>;
+
+  struct SendMetrics {
+    std::atomic<int> queued{0};
+    std::atomic<int> max_queued{0};
+    std::atomic<int64> max_latency_ticks{0};
+  };
+
+  // owns one output device and sends its messages on its own thread, so a slow
+  // device never holds up the caller
+  class DeviceWriter: private Thread {
+  public:
+    DeviceWriter(MidiOutput* device, int device_id, SendMetrics& metrics,
+      const std::atomic<int>& hold_time);
+    virtual ~DeviceWriter();
+    // queues the messages for a value, value and format as for
+    // BuildMessages_. Held instead if the control at index, its slot in
+    // SentValues, is being touched
+    void enqueue(const MIDI_Message& message, int value, FEEDBACK_FORMAT format,
+      int index, double timestamp);
+    // the control at index was moved by hand, starts or extends its hold
+    void touch(int index);
+    int getDeviceId() const noexcept {
+      return device_id_;
+    }
+    // guarded by MIDISender::mutex_
+    SentValues& lastSent() noexcept {
+      return last_sent_;
+    }
+  private:
+    // Thread interface
+    virtual void run() override;
+    // adds a value's messages to pending_, called with mutex_ held
+    void Queue_(const MIDI_Message& message, int value, FEEDBACK_FORMAT format,
+      double timestamp);
+
+    std::unique_ptr<MidiOutput> device_;
+    const int device_id_; // see MIDIDeviceList
+    SendMetrics& metrics_;
+    const std::atomic<int>& hold_time_;
+    SentValues last_sent_;
+    // last value for a touched control, sent when its hold ends
+    struct HeldValue {
+      MIDI_Message message;
+      int value;
+      FEEDBACK_FORMAT format;
+      bool pending;
+    };
+    // LatencyStats times of a queued message
+    struct Trace {
+      double timestamp; // read from the plugin
+      double queued;
+    };
+
+    std::mutex mutex_;
+    std::vector<HeldValue> held_; // indexed like SentValues
+    TimerWheel touched_; // end of each touched control's hold
+    MidiBuffer pending_;
+    std::vector<Trace> pending_traces_;
+    int pending_count_{0};
+    int64 oldest_pending_ticks_{0};
+  };
+
+  // fills out with the messages for a value, at most 4, and returns how many.
+  // value is 0-127 for FEEDBACK_FORMAT::CC7, 0-kMaxFeedbackValue otherwise
+  static int BuildMessages_(const MIDI_Message& message, int value,
+    FEEDBACK_FORMAT format, MidiMessage* out);
+  // true if an open output has the id, called with mutex_ held
+  bool HasDevice_(int device_id) const noexcept;
+  // slot in SentValues, -1 for an NRPN or an invalid message
+  static int CacheIndex_(int midi_channel, int controller,
+    FEEDBACK_FORMAT format) noexcept;
+
+  std::mutex mutex_;
+  std::mutex rescan_mutex_;
+  StringArray device_names_; // at the last rescan, guarded by rescan_mutex_
+  SendMetrics metrics_;
+  std::atomic<int> hold_time_;
+  OwnedArray<DeviceWriter> output_devices;
 };
 
 #endif  // MIDISENDER_H_INCLUDED
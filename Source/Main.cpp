@@ -34,6 +34,7 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 #include "LR_IPC_OUT.h"
 #include "MainComponent.h"
 #include "MainWindow.h"
+#include "MIDIDeviceWatcher.h"
 #include "MIDISender.h"
 #include "SettingsManager.h"
 #include "VersionChecker.h"
@@ -76,21 +77,26 @@ class MIDI2LRApplication: public JUCEApplication {
 //==============================================================================
   void initialise(const String& command_line) override {
     if (command_line != ShutDownString) {
-      midi_processor_->Init();
-      midi_sender_->Init();
+      midi_processor_->Init(command_map_);
+      midi_sender_->Init(midi_processor_);
       lr_ipc_out_->Init(command_map_, midi_processor_);
       //set the reference to the command map
       profile_manager_->Init(lr_ipc_out_, command_map_, midi_processor_);
       //init the IPC_In
-      lr_ipc_in_->Init(command_map_, profile_manager_, midi_sender_);
+      lr_ipc_in_->Init(command_map_, profile_manager_, midi_sender_, lr_ipc_out_);
       // init the settings manager
-      settings_manager_->Init(lr_ipc_out_, profile_manager_);
+      settings_manager_->Init(lr_ipc_out_, profile_manager_, midi_sender_);
       main_window_ = std::make_unique<MainWindow>(getApplicationName());
       main_window_->Init(command_map_, lr_ipc_in_, lr_ipc_out_, midi_processor_,
         profile_manager_, settings_manager_, midi_sender_);
+      // all the MIDI listeners are in place, start dispatching to them
+      midi_processor_->Start();
       // Check for latest version
       version_checker_.Init(settings_manager_);
       version_checker_.startThread();
+      // open and close MIDI devices as they are plugged in and removed
+      device_watcher_.Init(midi_processor_, midi_sender_, lr_ipc_in_);
+      device_watcher_.startThread();
     }
     else {
         // apparently the application is already terminated
@@ -99,8 +105,13 @@ class MIDI2LRApplication: public JUCEApplication {
   }
 
   void shutdown() override {//automatically invoked after quit
+    device_watcher_.PleaseStopThread(); //no more rescans
+    if (midi_processor_)
+      midi_processor_->PleaseStopThread(); //no more calls into listeners
     if (lr_ipc_in_)
       lr_ipc_in_->PleaseStopThread();
+    if (lr_ipc_out_)
+      lr_ipc_out_->PleaseStopThread();
       // Save the current profile as default.xml
     auto default_profile =
       File::getSpecialLocation(File::currentExecutableFile).getSiblingFile("default.xml");
@@ -145,8 +156,12 @@ class MIDI2LRApplication: public JUCEApplication {
   std::shared_ptr<SettingsManager> settings_manager_;
   std::unique_ptr<MainWindow> main_window_;
   VersionChecker version_checker_;
+  MIDIDeviceWatcher device_watcher_;
 };
 
 //==============================================================================
 // This macro generates the main() routine that launches the application.
-START_JUCE_APPLICATION(MIDI2LRApplication)
\ No newline at end of file
+// Benchmark.cpp has its own when MIDI2LR_BENCHMARK is defined
+#ifndef MIDI2LR_BENCHMARK
+START_JUCE_APPLICATION(MIDI2LRApplication)
+#endif
@@ -19,6 +19,7 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
   ==============================================================================
 */
 #include "MainComponent.h"
+#include <algorithm>
 #include "MIDISender.h"
 #include "SettingsComponent.h"
 
@@ -186,30 +187,57 @@ void MainContentComponent::paint(Graphics& g) {
   g.fillAll(Colours::white);
 }
 
-void MainContentComponent::handleMidiCC(int midi_channel, int controller, int value) {
+void MainContentComponent::handleMidiCC(const CommandMapping& mapping,
+  const MIDI_Message& message, int value, int /*max_value*/,
+  double /*timestamp*/) {
     // Display the CC parameters and add/highlight row in table corresponding to the CC
-  last_command_ = String::formatted("%d: CC%d [%d]", midi_channel, controller, value);
-  command_table_model_.addRow(midi_channel, controller, true);
-  row_to_select_ = command_table_model_.getRowForMessage(midi_channel, controller, true);
-  triggerAsyncUpdate();
+  ShowMessage_(message, String::formatted(message.isNRPN ? "%d: NRPN%d [%d]" :
+    "%d: CC%d [%d]", message.channel, message.controller, value),
+    mapping.kind == ACTION_KIND::LEARN_ONLY);
 }
 
-void MainContentComponent::handleMidiNote(int midi_channel, int note) {
+void MainContentComponent::handleMidiNote(const CommandMapping& mapping,
+  const MIDI_Message& message, double /*timestamp*/) {
     // Display the Note parameters and add/highlight row in table corresponding to the Note
-  last_command_ = String::formatted("%d: Note [%d]", midi_channel, note);
-  command_table_model_.addRow(midi_channel, note, false);
-  row_to_select_ = command_table_model_.getRowForMessage(midi_channel, note, false);
-  triggerAsyncUpdate();
+  ShowMessage_(message, String::formatted("%d: Note [%d]", message.channel,
+    message.pitch), mapping.kind == ACTION_KIND::LEARN_ONLY);
 }
 
-void MainContentComponent::connected() {
-  connection_label_.setText("Connected to LR", NotificationType::dontSendNotification);
-  connection_label_.setColour(Label::backgroundColourId, Colours::greenyellow);
+void MainContentComponent::ShowMessage_(const MIDI_Message& message,
+  const String& text, bool learn) {
+    // the table model belongs to the message thread, queue the row for
+    // handleAsyncUpdate
+  {
+    std::lock_guard<decltype(learn_mutex_)> lock(learn_mutex_);
+    last_command_ = text;
+    last_message_ = message;
+    if (learn && std::find(learned_.begin(), learned_.end(), message) ==
+      learned_.end())
+      learned_.push_back(message);
+  }
+  triggerAsyncUpdate();
 }
 
-void MainContentComponent::disconnected() {
-  connection_label_.setText("Not connected to LR", NotificationType::dontSendNotification);
-  connection_label_.setColour(Label::backgroundColourId, Colours::red);
+void MainContentComponent::connected() {}
+
+void MainContentComponent::disconnected() {}
+
+void MainContentComponent::connectionStateChanged(CONNECTION_STATE state) {
+    // the label follows both sockets, see LR_IPC_OUT::getConnectionState
+  switch (state) {
+    case CONNECTION_STATE::CONNECTED:
+      connection_label_.setText("Connected to LR", NotificationType::dontSendNotification);
+      connection_label_.setColour(Label::backgroundColourId, Colours::greenyellow);
+      break;
+    case CONNECTION_STATE::CONNECTING:
+      connection_label_.setText("Connecting to LR", NotificationType::dontSendNotification);
+      connection_label_.setColour(Label::backgroundColourId, Colours::orange);
+      break;
+    case CONNECTION_STATE::DISCONNECTED:
+      connection_label_.setText("Not connected to LR", NotificationType::dontSendNotification);
+      connection_label_.setColour(Label::backgroundColourId, Colours::red);
+      break;
+  }
 }
 
 void MainContentComponent::buttonClicked(Button* button) {
@@ -303,9 +331,10 @@ void MainContentComponent::buttonClicked(Button* button) {
     dialog_options.dialogTitle = "Settings";
     //create new object
     auto *component = new SettingsComponent{};
-    component->Init(settings_manager_);
+    component->Init(settings_manager_, midi_processor_, lr_ipc_in_,
+      midi_sender_, lr_ipc_out_);
     dialog_options.content.setOwned(component);
-    dialog_options.content->setSize(400, 300);
+    dialog_options.content->setSize(400, 680);
     dialog_options.escapeKeyTriggersCloseButton = true;
     dialog_options.useNativeTitleBar = false;
     settings_dialog_.reset(dialog_options.create());
@@ -343,14 +372,30 @@ void MainContentComponent::SetLabelSettings(Label &label_to_set) {
 }
 
 void MainContentComponent::handleAsyncUpdate() {
-    // Update the last command label and set its colour to green
-  command_label_.setText(last_command_, NotificationType::dontSendNotification);
+  std::vector<MIDI_Message> learned;
+  MIDI_Message message;
+  String text;
+  {
+    std::lock_guard<decltype(learn_mutex_)> lock(learn_mutex_);
+    learned.swap(learned_);
+    message = last_message_;
+    text = last_command_;
+  }
+  // Update the last command label and set its colour to green
+  command_label_.setText(text, NotificationType::dontSendNotification);
   command_label_.setColour(Label::backgroundColourId, Colours::greenyellow);
   startTimer(1000);
 
   // Update the command table to add and/or select row corresponding to midi command
+  if (!learned.empty() && command_map_) {
+      // one map change for the batch
+    command_map_->beginUpdate();
+    for (const auto& row : learned)
+      command_table_model_.addRow(row);
+    command_map_->endUpdate();
+  }
   command_table_.updateContent();
-  command_table_.selectRow(row_to_select_);
+  command_table_.selectRow(command_table_model_.getRowForMessage(message));
 }
 
 void MainContentComponent::timerCallback() {
@@ -26,6 +26,8 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef MAINCOMPONENT_H_INCLUDED
 #define MAINCOMPONENT_H_INCLUDED
 
+#include <mutex>
+#include <vector>
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "CommandMap.h"
 #include "CommandTable.h"
@@ -59,12 +61,16 @@ class MainContentComponent: public Component,
   void paint(Graphics&) override;
 
   // MIDICommandListener interface
-  virtual void handleMidiCC(int midi_channel, int controller, int value) override;
-  virtual void handleMidiNote(int midi_channel, int note) override;
+  virtual void handleMidiCC(const CommandMapping& mapping,
+    const MIDI_Message& message, int value, int max_value,
+    double timestamp) override;
+  virtual void handleMidiNote(const CommandMapping& mapping,
+    const MIDI_Message& message, double timestamp) override;
 
   // LRConnectionListener interface
   virtual void connected() override;
   virtual void disconnected() override;
+  virtual void connectionStateChanged(CONNECTION_STATE state) override;
 
   // Button interface
   virtual void buttonClicked(Button* button) override;
@@ -77,16 +83,19 @@ class MainContentComponent: public Component,
   void SetLabelSettings(Label &lblToSet);
 
 private:
-  // AsyncUpdater interface
+  // AsyncUpdater interface, adds the learned rows and shows the last message
+  // on the message thread
   virtual void handleAsyncUpdate() override;
 
+  // called on the MIDI dispatch thread
+  void ShowMessage_(const MIDI_Message& message, const String& text, bool learn);
+
   // Timer interface
   virtual void timerCallback() override;
 
   CommandTable command_table_{"Table", nullptr};
   CommandTableModel command_table_model_{};
   DropShadowEffect title_shadow_;
-  int row_to_select_;
   Label command_label_{"Command", ""};
   Label connection_label_{"Connection", "Not connected to LR"};
   Label current_status_{"CurrentStatus", "no extra info"};
@@ -100,7 +109,10 @@ class MainContentComponent: public Component,
   std::shared_ptr<MIDISender> midi_sender_{nullptr};
   std::shared_ptr<SettingsManager> settings_manager_{nullptr};
   std::unique_ptr<DialogWindow> settings_dialog_;
-  String last_command_;
+  MIDI_Message last_message_; // guarded by learn_mutex_
+  std::mutex learn_mutex_;
+  std::vector<MIDI_Message> learned_; // guarded by learn_mutex_
+  String last_command_; // guarded by learn_mutex_
   TextButton load_button_{"Load"};
   TextButton remove_row_button_{"Remove selected row"};
   TextButton rescan_button_{"Rescan MIDI devices"};
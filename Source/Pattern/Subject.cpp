@@ -20,6 +20,7 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "Subject.h"
+#include <algorithm>
 
 Subject::Subject() noexcept {}
 
@@ -31,18 +32,13 @@ void Subject::RegisterObserver(Observer * observer) {
 }
 
 void Subject::UnregisterObserver(Observer *observer) {
-    // using the for loop instead of the for ( auto &i : v ) as items will be removed
-  for (vector<Observer *>::iterator it = observers_.begin(); it != observers_.end(); ++it) {
-      //check if the pointers are the same
-    if ((*it) == observer) {
-        //erase and assign the iterator to the new position
-      it = observers_.erase(it);
-    }
-  }
+    // erase with remove, so every copy goes and no iterator is used after erase
+  observers_.erase(std::remove(observers_.begin(), observers_.end(), observer),
+    observers_.end());
 }
 
 void Subject::Notify(void) {
-    //check if the array is not empty.
-  if (!observers_.empty()) {
-  }
-}
\ No newline at end of file
+    // tell each observer about the change
+  for (auto observer : observers_)
+    observer->Changed(this);
+}
@@ -37,7 +37,9 @@ void ProfileManager::Init(std::shared_ptr<LR_IPC_OUT> out,
   }
 
   if (midiProcessor) {
-    midiProcessor->addMIDICommandListener(this);
+    midiProcessor->addMIDICommandListener(this,
+      ActionKindMask(ACTION_KIND::PREVIOUS_PROFILE) |
+      ActionKindMask(ACTION_KIND::NEXT_PROFILE));
   }
 }
 
@@ -104,42 +106,28 @@ void ProfileManager::switchToPreviousProfile() {
   switchToProfile(current_profile_index_);
 }
 
-void ProfileManager::handleMidiCC(int midi_channel, int controller, int value) {
-  const MIDI_Message cc{midi_channel, controller, true};
-
-  if (command_map_) {
-      // return if the value isn't 0 or 127, or the command isn't a valid
-      // profile-related command
-    if ((value != 127) || !command_map_->messageExistsInMap(cc))
-      return;
-
-    if (command_map_->getCommandforMessage(cc) == "Previous Profile") {
-      switch_state_ = SWITCH_STATE::PREV;
-      triggerAsyncUpdate();
-    }
-    else if (command_map_->getCommandforMessage(cc) == "Next Profile") {
-      switch_state_ = SWITCH_STATE::NEXT;
-      triggerAsyncUpdate();
-    }
-  }
+void ProfileManager::handleMidiCC(const CommandMapping& mapping,
+  const MIDI_Message& /*message*/, int value, int max_value,
+  double /*timestamp*/) {
+    // MIDIProcessor only calls this for profile-related commands; buttons
+    // send their maximum when pressed
+  if (value == max_value)
+    HandleProfileCommand_(mapping);
 }
 
-void ProfileManager::handleMidiNote(int midi_channel, int note) {
-  const MIDI_Message note_msg{midi_channel, note, false};
-
-  if (command_map_) {
-      // return if the command isn't a valid profile-related command
-    if (!command_map_->messageExistsInMap(note_msg))
-      return;
+void ProfileManager::handleMidiNote(const CommandMapping& mapping,
+  const MIDI_Message& /*message*/, double /*timestamp*/) {
+  HandleProfileCommand_(mapping);
+}
 
-    if (command_map_->getCommandforMessage(note_msg) == "Previous Profile") {
-      switch_state_ = SWITCH_STATE::PREV;
-      triggerAsyncUpdate();
-    }
-    else if (command_map_->getCommandforMessage(note_msg) == "Next Profile") {
-      switch_state_ = SWITCH_STATE::NEXT;
-      triggerAsyncUpdate();
-    }
+void ProfileManager::HandleProfileCommand_(const CommandMapping& mapping) {
+  if (mapping.kind == ACTION_KIND::PREVIOUS_PROFILE) {
+    switch_state_ = SWITCH_STATE::PREV;
+    triggerAsyncUpdate();
+  }
+  else if (mapping.kind == ACTION_KIND::NEXT_PROFILE) {
+    switch_state_ = SWITCH_STATE::NEXT;
+    triggerAsyncUpdate();
   }
 }
 
@@ -65,8 +65,11 @@ class ProfileManager: public MIDICommandListener,
   void switchToPreviousProfile();
 
   // MIDICommandListener interface
-  virtual void handleMidiCC(int midi_channel, int controller, int value) override;
-  virtual void handleMidiNote(int midi_channel, int note) override;
+  virtual void handleMidiCC(const CommandMapping& mapping,
+    const MIDI_Message& message, int value, int max_value,
+    double timestamp) override;
+  virtual void handleMidiNote(const CommandMapping& mapping,
+    const MIDI_Message& message, double timestamp) override;
 
   // LRConnectionListener interface
   virtual void connected() override;
@@ -75,6 +78,8 @@ class ProfileManager: public MIDICommandListener,
 private:
   // AsyncUpdate interface
   virtual void handleAsyncUpdate() override;
+  // queues a profile switch for a PREVIOUS_PROFILE or NEXT_PROFILE mapping
+  void HandleProfileCommand_(const CommandMapping& mapping);
   enum class SWITCH_STATE {
     NONE,
     PREV,
@@ -0,0 +1,37 @@
+/*
+  ==============================================================================
+
+    ReconnectBackoff.cpp
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#include "ReconnectBackoff.h"
+
+constexpr auto kFirstDelay = 250; // milliseconds
+constexpr auto kMaxDoublings = 5; // 250 ms doubles up to 8 s
+
+ReconnectBackoff::ReconnectBackoff() noexcept {}
+
+int ReconnectBackoff::nextDelay() noexcept {
+  const auto delay = kFirstDelay << jmin(failures_, kMaxDoublings);
+  if (failures_ < kMaxDoublings)
+    ++failures_;
+  return delay + random_.nextInt(delay / 2 + 1);
+}
+
+void ReconnectBackoff::reset() noexcept {
+  failures_ = 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+/*
+  ==============================================================================
+
+    ReconnectBackoff.h
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#ifndef RECONNECTBACKOFF_H_INCLUDED
+#define RECONNECTBACKOFF_H_INCLUDED
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+// state of a connection to the plugin
+enum class CONNECTION_STATE: uint8 {
+  DISCONNECTED,
+  CONNECTING,
+  CONNECTED,
+};
+
+// Delays between attempts to reach the plugin: short at first so a restarted
+// Lightroom is picked up quickly, growing while it stays away. Jitter keeps the
+// two sockets from retrying in lockstep.
+class ReconnectBackoff {
+public:
+  ReconnectBackoff() noexcept;
+
+  // delay before the next attempt, in milliseconds. Doubles after each failed
+  // attempt up to a limit, plus up to half as much again at random
+  int nextDelay() noexcept;
+
+  // call once connected, the next delay is the shortest one again
+  void reset() noexcept;
+
+private:
+  int failures_{0};
+  Random random_;
+};
+
+#endif  // RECONNECTBACKOFF_H_INCLUDED
@@ -0,0 +1,77 @@
+/*
+  ==============================================================================
+
+    SendRateControl.cpp
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#include "SendRateControl.h"
+#include "LatencyStats.h"
+
+constexpr auto kMaxWindow = 250; // milliseconds, keeps a slow Lightroom usable
+// an ack this late is taken as never coming, e.g. the line was lost when the
+// plugin reconnected
+constexpr auto kAckTimeout = 2000.0;
+constexpr auto kGain = 0.125; // weight of a new round trip, as for TCP's SRTT
+
+bool SendRateControl::wantsSample(double time) {
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  ExpireSample_(time);
+  return sampled_at_ <= 0.0;
+}
+
+void SendRateControl::sent(LRCommandId command, double time) {
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  sampled_ = command;
+  sampled_at_ = time;
+}
+
+void SendRateControl::acknowledged(LRCommandId command, double time) {
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  if (sampled_at_ <= 0.0 || command != sampled_)
+    return; // e.g. a sample sent before reconnecting
+  const auto sample = time - sampled_at_;
+  sampled_at_ = 0.0;
+  if (sample < 0.0 || sample > kAckTimeout)
+    return;
+  LatencyStats::recordSince(LATENCY_STAGE::ROUND_TRIP, time - sample);
+  round_trip_ = round_trip_ <= 0.0 ? sample :
+    round_trip_ + kGain * (sample - round_trip_);
+}
+
+void SendRateControl::reset() {
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  sampled_at_ = 0.0;
+}
+
+int SendRateControl::window(int minimum, double time) {
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  ExpireSample_(time);
+  auto window = round_trip_;
+  if (sampled_at_ > 0.0)
+    window = jmax(window, time - sampled_at_); // Lightroom is falling behind
+  return jmax(minimum, jmin(kMaxWindow, roundToInt(window)));
+}
+
+double SendRateControl::getRoundTrip() const {
+  std::lock_guard<decltype(mutex_)> lock(mutex_);
+  return round_trip_;
+}
+
+void SendRateControl::ExpireSample_(double time) {
+  if (sampled_at_ > 0.0 && time - sampled_at_ > kAckTimeout)
+    sampled_at_ = 0.0;
+}
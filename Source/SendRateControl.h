@@ -0,0 +1,70 @@
+#pragma once
+/*
+  ==============================================================================
+
+    SendRateControl.h
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#ifndef SENDRATECONTROL_H_INCLUDED
+#define SENDRATECONTROL_H_INCLUDED
+
+#include <mutex>
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "LRCommands.h"
+
+// Paces parameter values to how fast Lightroom applies them. One value at a
+// time is sampled: it is preceded by "AckNext <parameter>" and the plugin
+// answers it with "Ack <parameter>" once Lightroom has applied it, so the time
+// from sending the value to its ack is a round trip through Lightroom's queue.
+// The coalescing window follows the smoothed round trip, about one value per
+// parameter per round trip, and stretches while a sample's ack is later than
+// that. Times are in milliseconds, see LatencyStats::now.
+class SendRateControl {
+public:
+  SendRateControl() = default;
+
+  // true if no sampled value is waiting for its ack at time, so the next
+  // value sent should be sampled
+  bool wantsSample(double time);
+
+  // a sampled value for the command was written to the plugin at time
+  void sent(LRCommandId command, double time);
+
+  // the plugin acknowledged the sampled value for the command at time
+  void acknowledged(LRCommandId command, double time);
+
+  // forgets the sample waiting for an ack, e.g. after reconnecting. The round
+  // trip estimate is kept
+  void reset();
+
+  // coalescing window to use at time, never less than minimum
+  int window(int minimum, double time);
+
+  // smoothed round trip, 0 until the first ack
+  double getRoundTrip() const;
+
+private:
+  // drops the sample if its ack is too late to come. Call with mutex_ held
+  void ExpireSample_(double time);
+
+  mutable std::mutex mutex_;
+  LRCommandId sampled_{0}; // command of the sample, valid while sampled_at_ > 0
+  double sampled_at_{0.0};
+  double round_trip_{0.0};
+};
+
+#endif  // SENDRATECONTROL_H_INCLUDED
@@ -21,18 +21,30 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "SettingsComponent.h"
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "LatencyStats.h"
 
 constexpr auto SettingsLeft = 20;
 constexpr auto SettingsWidth = 400;
-constexpr auto SettingsHeight = 300;
+constexpr auto SettingsHeight = 680;
+constexpr auto kLatencyRefresh = 500; // milliseconds
 
 SettingsComponent::SettingsComponent(): ResizableLayout{this} {}
 
-SettingsComponent::~SettingsComponent() {}
+SettingsComponent::~SettingsComponent() {
+  stopTimer();
+}
 
-void SettingsComponent::Init(std::shared_ptr<SettingsManager>& settings_manager) {
-    //copy the pointer
+void SettingsComponent::Init(std::shared_ptr<SettingsManager>& settings_manager,
+  std::shared_ptr<MIDIProcessor>& midi_processor,
+  std::shared_ptr<LR_IPC_IN>& lr_ipc_in,
+  std::shared_ptr<MIDISender>& midi_sender,
+  std::shared_ptr<LR_IPC_OUT>& lr_ipc_out) {
+    //copy the pointers
   settings_manager_ = settings_manager;
+  midi_processor_ = midi_processor;
+  lr_ipc_in_ = lr_ipc_in;
+  midi_sender_ = midi_sender;
+  lr_ipc_out_ = lr_ipc_out;
 
   // for layouts to work you must start at some size
   // place controls in a location that is initially correct.
@@ -99,6 +111,74 @@ void SettingsComponent::Init(std::shared_ptr<SettingsManager>& settings_manager)
     //add this as the lister for the data
     autohide_setting_.addListener(this);
     addAndMakeVisible(autohide_setting_);
+
+    ////// ----------------------- coalesce section ------------------------------------
+    coalesce_group_.setText("Coalescing");
+    coalesce_group_.setBounds(0, 300, SettingsWidth, 80);
+    addToLayout(&coalesce_group_, anchorMidLeft, anchorMidRight);
+    addAndMakeVisible(coalesce_group_);
+
+    coalesce_explain_label_.setFont(Font{12.f, Font::bold});
+    coalesce_explain_label_.setText("Shortest time, in milliseconds, controller moves are collected before being sent to LR", NotificationType::dontSendNotification);
+    coalesce_explain_label_.setBounds(SettingsLeft, 315, SettingsWidth - 2 * SettingsLeft, 30);
+    addToLayout(&coalesce_explain_label_, anchorMidLeft, anchorMidRight);
+    coalesce_explain_label_.setEditable(false);
+    coalesce_explain_label_.setColour(Label::textColourId, Colours::darkgrey);
+    addAndMakeVisible(coalesce_explain_label_);
+
+    coalesce_setting_.setBounds(SettingsLeft, 340, SettingsWidth - 2 * SettingsLeft, 35);
+    coalesce_setting_.setRange(0, 100, 5);
+    coalesce_setting_.setValue(ptr->getCoalesceWindow(), NotificationType::dontSendNotification);
+    addToLayout(&coalesce_setting_, anchorMidLeft, anchorMidRight);
+    coalesce_setting_.addListener(this);
+    addAndMakeVisible(coalesce_setting_);
+
+    ////// ----------------------- feedback hold section ------------------------------------
+    hold_group_.setText("Feedback hold");
+    hold_group_.setBounds(0, 380, SettingsWidth, 80);
+    addToLayout(&hold_group_, anchorMidLeft, anchorMidRight);
+    addAndMakeVisible(hold_group_);
+
+    hold_explain_label_.setFont(Font{12.f, Font::bold});
+    hold_explain_label_.setText("Time, in milliseconds, LR's values are kept from a fader or knob after it is moved by hand", NotificationType::dontSendNotification);
+    hold_explain_label_.setBounds(SettingsLeft, 395, SettingsWidth - 2 * SettingsLeft, 30);
+    addToLayout(&hold_explain_label_, anchorMidLeft, anchorMidRight);
+    hold_explain_label_.setEditable(false);
+    hold_explain_label_.setColour(Label::textColourId, Colours::darkgrey);
+    addAndMakeVisible(hold_explain_label_);
+
+    hold_setting_.setBounds(SettingsLeft, 420, SettingsWidth - 2 * SettingsLeft, 35);
+    hold_setting_.setRange(0, 2000, 50);
+    hold_setting_.setValue(ptr->getFeedbackHoldTime(), NotificationType::dontSendNotification);
+    addToLayout(&hold_setting_, anchorMidLeft, anchorMidRight);
+    hold_setting_.addListener(this);
+    addAndMakeVisible(hold_setting_);
+
+    ////// ----------------------- latency section ------------------------------------
+    latency_group_.setText("Latency");
+    latency_group_.setBounds(0, 460, SettingsWidth, 220);
+    addToLayout(&latency_group_, anchorMidLeft, anchorMidRight);
+    addAndMakeVisible(latency_group_);
+
+    latency_report_.setMultiLine(true);
+    latency_report_.setReadOnly(true);
+    latency_report_.setFont(Font{Font::getDefaultMonospacedFontName(), 11.f,
+      Font::plain});
+    latency_report_.setBounds(SettingsLeft / 2, 480, SettingsWidth - SettingsLeft, 160);
+    addToLayout(&latency_report_, anchorMidLeft, anchorMidRight);
+    addAndMakeVisible(latency_report_);
+
+    latency_save_button_.addListener(this);
+    latency_save_button_.setBounds(SettingsLeft, 645, SettingsWidth / 2 - SettingsLeft - 5, 25);
+    addToLayout(&latency_save_button_, anchorMidLeft, anchorMidRight);
+    addAndMakeVisible(latency_save_button_);
+
+    latency_reset_button_.addListener(this);
+    latency_reset_button_.setBounds(SettingsWidth / 2 + 5, 645, SettingsWidth / 2 - SettingsLeft - 5, 25);
+    addToLayout(&latency_reset_button_, anchorMidLeft, anchorMidRight);
+    addAndMakeVisible(latency_reset_button_);
+    timerCallback();
+    startTimer(kLatencyRefresh);
     // turn it on
     activateLayout();
   }
@@ -135,6 +215,62 @@ void SettingsComponent::buttonClicked(Button* button) {
         NotificationType::dontSendNotification);
     }
   }
+  else if (button == &latency_save_button_) {
+    WildcardFileFilter wildcard_filter{"*.txt", String::empty, "Latency reports"};
+    FileBrowserComponent browser{FileBrowserComponent::canSelectFiles |
+      FileBrowserComponent::saveMode |
+        FileBrowserComponent::warnAboutOverwriting,
+      File::getSpecialLocation(File::userDocumentsDirectory)
+      .getChildFile("MIDI2LR latency.txt"),
+      &wildcard_filter, nullptr};
+    FileChooserDialogBox dialog_box{"Save latency report",
+        "Enter filename to save the latency report",
+        browser,
+        true,
+        Colours::lightgrey};
+    if (dialog_box.show()) {
+      const auto file = browser.getSelectedFile(0).withFileExtension("txt");
+      if (!LatencyStats::dumpToFile(file, CounterReport_()))
+        AlertWindow::showMessageBoxAsync(AlertWindow::WarningIcon,
+          "Latency report", "Couldn't write " + file.getFullPathName());
+    }
+  }
+  else if (button == &latency_reset_button_) {
+    LatencyStats::reset();
+    timerCallback();
+  }
+}
+
+void SettingsComponent::timerCallback() {
+  latency_report_.setText(LatencyStats::getReport() + CounterReport_(), false);
+}
+
+String SettingsComponent::CounterReport_() const {
+  String report;
+  if (const auto ptr = midi_processor_.lock()) {
+    report += String::formatted("%-22s %8.1f\n", "MIDI callback max (us)",
+      ptr->getMaxCallbackMicroseconds());
+    report += String::formatted("%-22s %8u\n", "MIDI events dropped",
+      ptr->getDroppedEventCount());
+  }
+  if (const auto ptr = lr_ipc_in_.lock())
+    report += String::formatted("%-22s %8u\n", "LR lines too long",
+      ptr->getOversizeLineCount());
+  if (const auto ptr = lr_ipc_out_.lock()) {
+    report += String::formatted("%-22s %8u\n", "LR commands dropped",
+      ptr->getDroppedCommandCount());
+    report += String::formatted("%-22s %8.2f\n", "LR round trip (ms)",
+      ptr->getRoundTrip());
+  }
+  if (const auto ptr = midi_sender_.lock()) {
+    report += String::formatted("%-22s %8d\n", "MIDI out queued",
+      ptr->getQueueDepth());
+    report += String::formatted("%-22s %8d\n", "MIDI out queued max",
+      ptr->getMaxQueueDepth());
+    report += String::formatted("%-22s %8.1f\n", "MIDI out send max (us)",
+      ptr->getMaxSendLatencyMicroseconds());
+  }
+  return report;
 }
 
 void SettingsComponent::sliderValueChanged(Slider* slider) {
@@ -148,5 +284,15 @@ void SettingsComponent::sliderValueChanged(Slider* slider) {
         ptr->setAutoHideTime(new_setting);
       }
     }
+    else if (&coalesce_setting_ == slider) {
+      if (auto ptr = settings_manager_.lock()) {
+        ptr->setCoalesceWindow(static_cast<int>(coalesce_setting_.getValue()));
+      }
+    }
+    else if (&hold_setting_ == slider) {
+      if (auto ptr = settings_manager_.lock()) {
+        ptr->setFeedbackHoldTime(static_cast<int>(hold_setting_.getValue()));
+      }
+    }
   }
 }
@@ -23,15 +23,24 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 #define SETTINGSCOMPONENT_H_INCLUDED
 
 #include "../JuceLibraryCode/JuceHeader.h"
+#include "LR_IPC_In.h"
+#include "LR_IPC_Out.h"
+#include "MIDIProcessor.h"
+#include "MIDISender.h"
 #include "ResizableLayout.h"
 #include "SettingsManager.h"
 
 class SettingsComponent: public Component,
-  public ButtonListener, private ResizableLayout, public Slider::Listener {
+  public ButtonListener, private ResizableLayout, public Slider::Listener,
+  private Timer {
 public:
   SettingsComponent();
   ~SettingsComponent();
-  void Init(std::shared_ptr<SettingsManager>& settings_manager);
+  void Init(std::shared_ptr<SettingsManager>& settings_manager,
+    std::shared_ptr<MIDIProcessor>& midi_processor,
+    std::shared_ptr<LR_IPC_IN>& lr_ipc_in,
+    std::shared_ptr<MIDISender>& midi_sender,
+    std::shared_ptr<LR_IPC_OUT>& lr_ipc_out);
 
   void paint(Graphics&) override;
   //void resized();
@@ -41,15 +50,35 @@ class SettingsComponent: public Component,
   virtual void sliderValueChanged(Slider* slider) override;
 
 private:
+  // Timer interface, refreshes the latency report
+  virtual void timerCallback() override;
+
+  // counters shown below the latency histograms
+  String CounterReport_() const;
+
   GroupComponent autohide_group_{};
+  GroupComponent coalesce_group_{};
+  GroupComponent hold_group_{};
+  GroupComponent latency_group_{};
   GroupComponent pickup_group_{};
   GroupComponent profile_group_{};
   Label autohide_explain_label_{};
+  Label coalesce_explain_label_{};
+  Label hold_explain_label_{};
   Label pickup_label_{"PickupLabel", ""};
   Label profile_location_label_{"Profile Label"};
   Slider autohide_setting_;
+  Slider coalesce_setting_;
+  Slider hold_setting_;
+  std::weak_ptr<LR_IPC_IN> lr_ipc_in_;
+  std::weak_ptr<LR_IPC_OUT> lr_ipc_out_;
+  std::weak_ptr<MIDIProcessor> midi_processor_;
+  std::weak_ptr<MIDISender> midi_sender_;
   std::weak_ptr<SettingsManager> settings_manager_;
+  TextButton latency_reset_button_{"Reset"};
+  TextButton latency_save_button_{"Save Report"};
   TextButton profile_location_button_{"Choose Profile Folder"};
+  TextEditor latency_report_{};
   ToggleButton pickup_enabled_{"Enable Pickup Mode"};
 
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SettingsComponent)
@@ -46,16 +46,23 @@ SettingsManager::SettingsManager() {
 }
 
 void SettingsManager::Init(std::shared_ptr<LR_IPC_OUT>& lr_ipc_out,
-  std::shared_ptr<ProfileManager>& profile_manager) {
+  std::shared_ptr<ProfileManager>& profile_manager,
+  std::shared_ptr<MIDISender>& midi_sender) {
   lr_ipc_out_ = lr_ipc_out;
 
   if (lr_ipc_out_) {
       // add ourselves as a listener to LR_IPC_OUT so that we can send plugin
       // settings on connection
     lr_ipc_out_->addListener(this);
+    lr_ipc_out_->setCoalesceWindow(getCoalesceWindow());
+    lr_ipc_out_->setPickupEnabled(getPickupEnabled());
   }
 
   profile_manager_ = profile_manager;
+  midi_sender_ = midi_sender;
+
+  if (midi_sender_)
+    midi_sender_->setHoldTime(getFeedbackHoldTime());
 
   if (profile_manager_) {
       // set the profile directory
@@ -72,10 +79,8 @@ void SettingsManager::setPickupEnabled(bool enabled) {
   properties_file_->setValue("pickup_enabled", enabled);
   properties_file_->saveIfNeeded();
 
-  auto command = String::formatted("Pickup %d\n", enabled);
-
   if (lr_ipc_out_) {
-    lr_ipc_out_->sendCommand(command);
+    lr_ipc_out_->setPickupEnabled(enabled);
   }
 }
 String SettingsManager::getProfileDirectory() const noexcept {
@@ -93,7 +98,8 @@ void SettingsManager::setProfileDirectory(const String& profile_directory_name)
 }
 
 void SettingsManager::connected() {
-  auto command = String::formatted("Pickup %d\n", getPickupEnabled());
+    // pickup is decided before values are sent, the plugin takes them all
+  auto command = String{"Pickup 0\n"};
 
   if (lr_ipc_out_) {
     lr_ipc_out_->sendCommand(command);
@@ -119,3 +125,29 @@ void SettingsManager::setLastVersionFound(int new_version) {
   properties_file_->setValue("LastVersionFound", new_version);
   properties_file_->saveIfNeeded();
 }
+
+int SettingsManager::getCoalesceWindow() const noexcept {
+  return properties_file_->getIntValue("coalesce_window", 30);
+}
+
+void SettingsManager::setCoalesceWindow(int milliseconds) {
+  properties_file_->setValue("coalesce_window", milliseconds);
+  properties_file_->saveIfNeeded();
+
+  if (lr_ipc_out_) {
+    lr_ipc_out_->setCoalesceWindow(milliseconds);
+  }
+}
+
+int SettingsManager::getFeedbackHoldTime() const noexcept {
+  return properties_file_->getIntValue("feedback_hold_time", 300);
+}
+
+void SettingsManager::setFeedbackHoldTime(int milliseconds) {
+  properties_file_->setValue("feedback_hold_time", milliseconds);
+  properties_file_->saveIfNeeded();
+
+  if (midi_sender_) {
+    midi_sender_->setHoldTime(milliseconds);
+  }
+}
@@ -24,6 +24,7 @@ MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "../JuceLibraryCode/JuceHeader.h"
 #include "LR_IPC_OUT.h"
+#include "MIDISender.h"
 #include "ProfileManager.h"
 
 class SettingsManager: public LRConnectionListener {
@@ -31,7 +32,8 @@ class SettingsManager: public LRConnectionListener {
   SettingsManager();
   virtual ~SettingsManager() {};
   void Init(std::shared_ptr<LR_IPC_OUT>& lr_IPC_OUT,
-    std::shared_ptr<ProfileManager>& profile_manager);
+    std::shared_ptr<ProfileManager>& profile_manager,
+    std::shared_ptr<MIDISender>& midi_sender);
 
   bool getPickupEnabled() const noexcept;
   void setPickupEnabled(bool enabled);
@@ -49,10 +51,20 @@ class SettingsManager: public LRConnectionListener {
   int getLastVersionFound() const noexcept;
   void setLastVersionFound(int version_number);
 
+  // shortest time, in milliseconds, CC values are coalesced before being sent
+  // to LR. Lightroom's round trip can make the window longer
+  int getCoalesceWindow() const noexcept;
+  void setCoalesceWindow(int milliseconds);
+
+  // milliseconds feedback to a control is held back after it is moved by hand
+  int getFeedbackHoldTime() const noexcept;
+  void setFeedbackHoldTime(int milliseconds);
+
 private:
 
   std::shared_ptr<LR_IPC_OUT> lr_ipc_out_{nullptr};
   std::shared_ptr<ProfileManager> profile_manager_{nullptr};
+  std::shared_ptr<MIDISender> midi_sender_{nullptr};
   std::unique_ptr<PropertiesFile> properties_file_;
 };
 
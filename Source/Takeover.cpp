@@ -0,0 +1,83 @@
+/*
+  ==============================================================================
+
+    Takeover.cpp
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#include "Takeover.h"
+#include <cstdlib>
+#include "LRCommands.h"
+
+constexpr auto kUnknownValue = -1;
+// controller and parameter are taken as matching this close, 4 of the plugin's
+// 127 steps
+constexpr auto kPickupThreshold = 4 * 129;
+// a controller that has caught its parameter keeps it this long after each
+// move, since the plugin's echoes of what was sent lag behind a fast fader
+constexpr auto kHoldTime = 500.0; // milliseconds
+
+Takeover::Takeover(): parameters_{new std::atomic<int>[LRCommandList::kMaxCommands]},
+  controllers_(LRCommandList::kMaxCommands) {
+  for (size_t command = 0; command < LRCommandList::kMaxCommands; ++command)
+    parameters_[command] = kUnknownValue;
+}
+
+void Takeover::setPickupEnabled(bool enabled) noexcept {
+  pickup_enabled_ = enabled;
+}
+
+void Takeover::setParameterValue(LRCommandId command, int value) noexcept {
+  if (command < LRCommandList::kMaxCommands)
+    parameters_[command] = value;
+}
+
+int Takeover::process(LRCommandId command, TAKEOVER_MODE mode,
+  int value) noexcept {
+  if (command >= LRCommandList::kMaxCommands)
+    return value;
+  auto& controller = controllers_[command];
+  const auto previous = controller.value;
+  controller.value = value;
+  if (mode == TAKEOVER_MODE::DEFAULT)
+    mode = pickup_enabled_ ? TAKEOVER_MODE::PICKUP : TAKEOVER_MODE::JUMP;
+  const auto parameter = parameters_[command].load();
+  const auto now = Time::getMillisecondCounterHiRes();
+  auto result = value;
+  if (mode != TAKEOVER_MODE::JUMP && parameter != kUnknownValue &&
+    now >= controller.caught_until) {
+      // caught when close enough or when the controller passed the parameter
+    const auto caught = std::abs(value - parameter) <= kPickupThreshold ||
+      (previous != kUnknownValue &&
+      (previous - parameter) * (value - parameter) <= 0);
+    if (!caught) {
+      if (mode == TAKEOVER_MODE::PICKUP || previous == kUnknownValue ||
+        previous == value)
+        return kUnknownValue;
+        // SCALE: move the parameter by the share of the distance left to the
+        // end the controller is heading for, so both arrive there together
+      if (value > previous)
+        result = parameter + (value - previous) * (kMaxFeedbackValue - parameter) /
+        (kMaxFeedbackValue - previous);
+      else
+        result = parameter - (previous - value) * parameter / previous;
+    }
+  }
+  if (result == value)
+    controller.caught_until = now + kHoldTime;
+  parameters_[command] = result;
+  return result;
+}
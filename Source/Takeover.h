@@ -0,0 +1,63 @@
+#pragma once
+/*
+  ==============================================================================
+
+    Takeover.h
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#ifndef TAKEOVER_H_INCLUDED
+#define TAKEOVER_H_INCLUDED
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "../JuceLibraryCode/JuceHeader.h"
+#include "CommandMap.h"
+
+// Decides, in the app, which values of an absolute controller are sent to the
+// plugin when the controller doesn't show its parameter's value, so values
+// that would be rejected never cross the socket. Values run
+// 0-kMaxFeedbackValue. The parameters' values come from the plugin and from
+// what this sends.
+class Takeover {
+public:
+  Takeover();
+
+  // turns pickup on or off for mappings with TAKEOVER_MODE::DEFAULT
+  void setPickupEnabled(bool enabled) noexcept;
+
+  // records a parameter's value sent by the plugin, safe to call from any
+  // thread
+  void setParameterValue(LRCommandId command, int value) noexcept;
+
+  // value to send for a controller moved to value, or -1 if nothing is sent.
+  // Call from one thread only
+  int process(LRCommandId command, TAKEOVER_MODE mode, int value) noexcept;
+
+private:
+  struct ControllerState {
+    int value{-1}; // last value of the controller, -1 if it hasn't moved
+    double caught_until{0.0}; // ms, see Time::getMillisecondCounterHiRes
+  };
+
+  std::atomic<bool> pickup_enabled_{true};
+  // indexed by command id, -1 if the value isn't known
+  std::unique_ptr<std::atomic<int>[]> parameters_;
+  std::vector<ControllerState> controllers_; // process's thread only
+};
+
+#endif  // TAKEOVER_H_INCLUDED
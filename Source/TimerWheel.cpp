@@ -0,0 +1,101 @@
+/*
+  ==============================================================================
+
+    TimerWheel.cpp
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#include "TimerWheel.h"
+#include <cmath>
+
+constexpr auto kTickLength = 10.0; // milliseconds
+constexpr auto kSlotCount = 64; // one turn is 640 ms, later deadlines wait a turn
+
+namespace {
+  int64 TickOf(double time) noexcept {
+    return static_cast<int64>(std::ceil(time / kTickLength));
+  }
+}
+
+TimerWheel::TimerWheel(int capacity): entries_(static_cast<size_t>(capacity)),
+  slots_(kSlotCount, -1) {}
+
+void TimerWheel::schedule(int key, double deadline) {
+  if (key < 0 || key >= static_cast<int>(entries_.size()))
+    return;
+  cancel(key);
+  auto& entry = entries_[static_cast<size_t>(key)];
+    // a deadline already passed comes due on the next advance
+  entry.tick = jmax(TickOf(deadline), current_tick_ + 1);
+  auto& head = slots_[static_cast<size_t>(entry.tick % kSlotCount)];
+  entry.previous = -1;
+  entry.next = head;
+  if (head >= 0)
+    entries_[static_cast<size_t>(head)].previous = key;
+  head = key;
+  entry.scheduled = true;
+  ++scheduled_;
+}
+
+void TimerWheel::cancel(int key) noexcept {
+  if (key < 0 || key >= static_cast<int>(entries_.size()) ||
+    !entries_[static_cast<size_t>(key)].scheduled)
+    return;
+  Unlink_(key);
+  entries_[static_cast<size_t>(key)].scheduled = false;
+  --scheduled_;
+}
+
+void TimerWheel::advance(double now, const std::function<void(int)>& expired) {
+  const auto now_tick = static_cast<int64>(std::floor(now / kTickLength));
+  if (scheduled_ == 0) {
+    // nothing can be due in between, skip straight to now
+    current_tick_ = jmax(current_tick_, now_tick);
+    return;
+  }
+    // a full turn visits every slot, more would only repeat them
+  auto tick = now_tick - kSlotCount + 1;
+  if (current_tick_ >= 0)
+    tick = jmax(tick, current_tick_ + 1);
+  for (; tick <= now_tick && scheduled_ > 0; ++tick) {
+    auto key = slots_[static_cast<size_t>(tick % kSlotCount)];
+    while (key >= 0) {
+      const auto next = entries_[static_cast<size_t>(key)].next;
+      if (entries_[static_cast<size_t>(key)].tick <= now_tick) {
+        cancel(key);
+        expired(key);
+      }
+      key = next;
+    }
+  }
+  current_tick_ = jmax(current_tick_, now_tick);
+}
+
+double TimerWheel::tickLength() noexcept {
+  return kTickLength;
+}
+
+void TimerWheel::Unlink_(int key) noexcept {
+  auto& entry = entries_[static_cast<size_t>(key)];
+  if (entry.previous >= 0)
+    entries_[static_cast<size_t>(entry.previous)].next = entry.next;
+  else
+    slots_[static_cast<size_t>(entry.tick % kSlotCount)] = entry.next;
+  if (entry.next >= 0)
+    entries_[static_cast<size_t>(entry.next)].previous = entry.previous;
+  entry.next = -1;
+  entry.previous = -1;
+}
@@ -0,0 +1,79 @@
+#pragma once
+/*
+  ==============================================================================
+
+    TimerWheel.h
+
+This file is part of MIDI2LR. Copyright 2015-2016 by Rory Jaffe.
+
+MIDI2LR is free software: you can redistribute it and/or modify it under the
+terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or (at your option) any later
+version.
+
+MIDI2LR is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+MIDI2LR.  If not, see <http://www.gnu.org/licenses/>.
+  ==============================================================================
+*/
+#ifndef TIMERWHEEL_H_INCLUDED
+#define TIMERWHEEL_H_INCLUDED
+
+#include <functional>
+#include <vector>
+#include "../JuceLibraryCode/JuceHeader.h"
+
+// Deadlines for a fixed set of keys, 0 to capacity - 1, each with at most one
+// deadline. Scheduling, rescheduling and cancelling take constant time and
+// advancing only visits the slots that have come due, so hundreds of keys
+// rescheduled on every message stay cheap. Times are in milliseconds, see
+// Time::getMillisecondCounterHiRes. Not thread safe.
+class TimerWheel {
+public:
+  explicit TimerWheel(int capacity);
+
+  // sets the key's deadline, replacing any earlier one
+  void schedule(int key, double deadline);
+
+  // removes the key's deadline, if it has one
+  void cancel(int key) noexcept;
+
+  // true if the key has a deadline
+  bool isScheduled(int key) const noexcept {
+    return key >= 0 && key < static_cast<int>(entries_.size()) &&
+      entries_[static_cast<size_t>(key)].scheduled;
+  }
+
+  // true if no key has a deadline
+  bool empty() const noexcept {
+    return scheduled_ == 0;
+  }
+
+  // calls expired for each key whose deadline is at or before now, after
+  // removing its deadline. expired must not change the wheel
+  void advance(double now, const std::function<void(int)>& expired);
+
+  // resolution of the deadlines, in milliseconds
+  static double tickLength() noexcept;
+
+private:
+  struct Entry {
+    int64 tick{0}; // deadline, rounded up to a whole tick
+    int next{-1}; // in the slot's list
+    int previous{-1};
+    bool scheduled{false};
+  };
+
+  // removes the key from its slot's list
+  void Unlink_(int key) noexcept;
+
+  std::vector<Entry> entries_; // indexed by key
+  std::vector<int> slots_; // first key of each slot's list, -1 if none
+  int64 current_tick_{-1}; // last tick advanced to
+  int scheduled_{0};
+};
+
+#endif  // TIMERWHEEL_H_INCLUDED